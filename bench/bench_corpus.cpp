@@ -0,0 +1,385 @@
+// Бенчмарк движков v1 и v2 на синтетических корпусах.
+//
+// Корпуса: длинная цепочка, широкий веер, ромбы (один заголовок по многим путям),
+// много include-каталогов, огромные файлы, CRLF+BOM. Каждый корпус прогоняется
+// через v1::Preprocess, v1::FlattenProject, v2::Preprocess, v2::FlattenProject;
+// выходы v1 и v2 одного режима сравниваются (с поправкой на то, что v2 убирает
+// BOM и '\r' перед '\n').
+//
+// Каждый прогон — в отдельном дочернем процессе (POSIX, fork + exec себя же):
+// пиковый RSS и число вызовов read/write (/proc/self/io: syscr/syscw; open/stat/mmap
+// туда не входят) относятся только к нему.
+//
+// Вывод — JSON по строке на (корпус, движок), чтобы складывать в историю:
+//   {"corpus":"deep_chain","engine":"v2_flatten","ok":true,"agree":true,"ms":...,
+//    "out_bytes":...,"mb_s":...,"files":...,"files_s":...,"syscr":...,"syscw":...,"peak_rss_kb":...}
+// Код возврата 1 — выходы разошлись или прогон упал.
+//
+// g++ -std=gnu++17 -O2 bench/bench_corpus.cpp -o bench_corpus.exe
+// bench_corpus.exe [--scale=K] [--reps=N] [--only=<корпус>]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/wait.h>
+#include <unistd.h>
+#define BENCH_FORK 1
+#endif
+
+#include "../v1_parts/v1_preprocess_impl.h"
+#include "../v2_parts/v2_preprocess_impl.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+using EngineFn = bool (*)(const fs::path&, const fs::path&, const std::vector<fs::path>&);
+
+struct Engine {
+    const char* name;
+    EngineFn fn;
+    bool flatten;
+};
+
+const Engine kEngines[] = {
+    {"v1_tz", &v1::Preprocess, false},
+    {"v1_flatten", static_cast<EngineFn>(&v1::FlattenProject), true},
+    {"v2_tz", &v2::Preprocess, false},
+    {"v2_flatten", static_cast<EngineFn>(&v2::FlattenProject), true},
+};
+
+struct Corpus {
+    std::string name;
+    fs::path main_file;
+    std::vector<fs::path> include_dirs;
+};
+
+// ---------- генераторы ----------
+
+void WriteFile(const fs::path& file, const std::string& text) {
+    fs::create_directories(file.parent_path());
+    std::ofstream(file, std::ios::binary) << text;
+}
+
+std::string Body(const std::string& tag, int lines, const char* eol = "\n") {
+    std::string text;
+    for (int i = 0; i < lines; ++i) text += "static int " + tag + "_" + std::to_string(i) + " = " + std::to_string(i) + ";" + eol;
+    return text;
+}
+
+// h0 -> h1 -> ... -> h<depth-1>
+Corpus DeepChain(const fs::path& root, int scale) {
+    const int depth = 2000 * scale;
+    for (int i = 0; i < depth; ++i) {
+        std::string text = "// chain " + std::to_string(i) + "\n";
+        if (i + 1 < depth) text += "#include \"h" + std::to_string(i + 1) + ".h\"\n";
+        text += Body("c" + std::to_string(i), 10);
+        WriteFile(root / ("h" + std::to_string(i) + ".h"), text);
+    }
+    return {"deep_chain", root / "h0.h", {}};
+}
+
+// main -> 2000 разных заголовков (crlf_bom: те же, но CRLF и BOM)
+Corpus WideFanout(const fs::path& root, int scale, const char* eol = "\n", bool bom = false,
+                  const std::string& name = "wide_fanout") {
+    const int width = 2000 * scale;
+    // BOM только в заголовках, первая строка которых — текст: v1 не узнаёт
+    // директиву сразу после BOM, и сравнивать было бы нечего
+    std::string main_text;
+    for (int i = 0; i < width; ++i) {
+        main_text += "#include \"w/h" + std::to_string(i) + ".h\"" + eol;
+        WriteFile(root / "w" / ("h" + std::to_string(i) + ".h"),
+                  (bom ? "\xEF\xBB\xBF" : "") + Body("w" + std::to_string(i), 50, eol));
+    }
+    main_text += std::string("int main() {}") + eol;
+    WriteFile(root / "main.cpp", main_text);
+    return {name, root / "main.cpp", {}};
+}
+
+// layers слоёв по width узлов; каждый узел подключает все узлы следующего слоя.
+// С #pragma once flatten вставляет каждый узел раз, ТЗ-режим — width^layer раз.
+Corpus Diamonds(const fs::path& root, int scale) {
+    const int layers = 5;
+    const int width = 5 + scale;
+    auto node = [](int layer, int k) { return "n" + std::to_string(layer) + "_" + std::to_string(k) + ".h"; };
+    for (int layer = 0; layer < layers; ++layer) {
+        for (int k = 0; k < width; ++k) {
+            std::string text = "#pragma once\n";
+            if (layer + 1 < layers) {
+                for (int j = 0; j < width; ++j) text += "#include \"" + node(layer + 1, j) + "\"\n";
+            }
+            text += Body("d" + std::to_string(layer) + "_" + std::to_string(k), 5);
+            WriteFile(root / node(layer, k), text);
+        }
+    }
+    std::string main_text;
+    for (int k = 0; k < width; ++k) main_text += "#include \"" + node(0, k) + "\"\n";
+    WriteFile(root / "main.cpp", main_text);
+    return {"diamonds", root / "main.cpp", {}};
+}
+
+// 50 каталогов include; заголовок k лежит только в каталоге k % dirs, так что поиск
+// проходит в среднем полсписка
+Corpus ManyDirs(const fs::path& root, int scale) {
+    const int dirs = 50;
+    const int headers = 1000 * scale;
+    Corpus corpus{"many_dirs", root / "src" / "main.cpp", {}};
+    for (int d = 0; d < dirs; ++d) corpus.include_dirs.push_back(root / ("inc" + std::to_string(d)));
+    std::string main_text;
+    for (int k = 0; k < headers; ++k) {
+        const std::string rel = "lib/h" + std::to_string(k) + ".h";
+        WriteFile(corpus.include_dirs[k % dirs] / rel, Body("m" + std::to_string(k), 20));
+        // кавычки: сначала src/, потом все каталоги; флэттен раскрывает только их
+        main_text += "#include \"" + rel + "\"\n";
+        main_text += "#include <" + rel + ">\n";
+    }
+    WriteFile(corpus.main_file, main_text);
+    return corpus;
+}
+
+// Несколько огромных файлов — меряется чистая пропускная способность копирования
+Corpus HugeFiles(const fs::path& root, int scale) {
+    const int files = 2;
+    const std::size_t bytes = static_cast<std::size_t>(32 * scale) << 20;
+    std::string chunk = Body("big", 20000);
+    std::string main_text;
+    for (int i = 0; i < files; ++i) {
+        const fs::path file = root / ("big" + std::to_string(i) + ".h");
+        fs::create_directories(root);
+        std::ofstream out(file, std::ios::binary);
+        for (std::size_t written = 0; written < bytes; written += chunk.size()) out << chunk;
+        main_text += "#include \"big" + std::to_string(i) + ".h\"\n";
+    }
+    WriteFile(root / "main.cpp", main_text);
+    return {"huge_files", root / "main.cpp", {}};
+}
+
+// ---------- сравнение выходов ----------
+
+std::string ReadBinary(const fs::path& file) {
+    std::ifstream in(file, std::ios::binary);
+    return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+}
+
+// v1 оставляет BOM и '\r' как есть, v2 их убирает — сравниваем без них
+std::string WithoutBomAndCR(std::string text) {
+    std::string out;
+    out.reserve(text.size());
+    for (std::size_t i = 0; i < text.size(); ++i) {
+        if (text.compare(i, 3, "\xEF\xBB\xBF") == 0) {
+            i += 2;
+            continue;
+        }
+        if (text[i] == '\r' && i + 1 < text.size() && text[i + 1] == '\n') continue;
+        out += text[i];
+    }
+    return out;
+}
+
+// ---------- один прогон ----------
+
+struct Result {
+    bool ok = false;
+    double ms = 0;
+    std::uint64_t out_bytes = 0;
+    long long syscr = -1;
+    long long syscw = -1;
+    long long peak_rss_kb = -1;
+};
+
+// -1 — счётчиков нет (не Linux или выключен task io accounting)
+void ReadSyscalls(long long& syscr, long long& syscw) {
+    syscr = syscw = -1;
+    std::ifstream io("/proc/self/io");
+    std::string key;
+    long long value = 0;
+    while (io >> key >> value) {
+        if (key == "syscr:") syscr = value;
+        if (key == "syscw:") syscw = value;
+    }
+}
+
+// Пик RSS этого адресного пространства (VmHWM), КиБ; -1 — не Linux.
+// ru_maxrss из wait4 не годится: он переживает exec и помнит память родителя.
+long long PeakRssKb() {
+    std::ifstream status("/proc/self/status");
+    std::string key;
+    while (status >> key) {
+        if (key == "VmHWM:") {
+            long long kb = -1;
+            status >> kb;
+            return kb;
+        }
+        status.ignore(1 << 20, '\n');
+    }
+    return -1;
+}
+
+Result RunInProcess(const Engine& engine, const Corpus& corpus, const fs::path& out_file) {
+    Result r;
+    long long r0 = 0, w0 = 0;
+    ReadSyscalls(r0, w0);
+    const auto t0 = std::chrono::steady_clock::now();
+    r.ok = engine.fn(corpus.main_file, out_file, corpus.include_dirs);
+    r.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    ReadSyscalls(r.syscr, r.syscw);
+    if (r0 >= 0 && r.syscr >= 0) {
+        r.syscr -= r0;
+        r.syscw -= w0;
+    }
+    std::error_code ec;
+    r.out_bytes = fs::file_size(out_file, ec);
+    r.peak_rss_kb = PeakRssKb();
+    return r;
+}
+
+// Дочерний процесс — заново запущенный этот же exe (fork + exec): свежее адресное
+// пространство, счётчики только его. Результат приходит через fd 3.
+const char* g_self = nullptr;
+constexpr int kResultFd = 3;
+
+Result Run(std::size_t engine_index, const Corpus& corpus, const fs::path& out_file) {
+#ifdef BENCH_FORK
+    int fds[2];
+    if (pipe(fds) != 0) return RunInProcess(kEngines[engine_index], corpus, out_file);
+    std::cout.flush();
+
+    std::vector<std::string> args = {g_self, "--child=" + std::to_string(engine_index),
+                                     corpus.main_file.string(), out_file.string()};
+    for (const auto& dir : corpus.include_dirs) args.push_back(dir.string());
+    std::vector<char*> argv;
+    for (auto& arg : args) argv.push_back(arg.data());
+    argv.push_back(nullptr);
+
+    const pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        if (fds[1] != kResultFd) {
+            dup2(fds[1], kResultFd);
+            close(fds[1]);
+        }
+        execv(g_self, argv.data());
+        _exit(127);
+    }
+    close(fds[1]);
+    Result r;
+    const bool got = read(fds[0], &r, sizeof(r)) == static_cast<ssize_t>(sizeof(r));
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!got || !WIFEXITED(status) || WEXITSTATUS(status) != 0) return Result{};
+    return r;
+#else
+    return RunInProcess(kEngines[engine_index], corpus, out_file);
+#endif
+}
+
+#ifdef BENCH_FORK
+// bench_corpus --child=<engine> <main> <out> [include_dir...]
+int ChildMain(int argc, char** argv) {
+    const std::size_t engine_index = std::strtoul(argv[1] + 8, nullptr, 10);
+    if (engine_index >= std::size(kEngines) || argc < 4) return 2;
+    Corpus corpus;
+    corpus.main_file = argv[2];
+    for (int i = 4; i < argc; ++i) corpus.include_dirs.push_back(argv[i]);
+    const Result r = RunInProcess(kEngines[engine_index], corpus, argv[3]);
+    return write(kResultFd, &r, sizeof(r)) == static_cast<ssize_t>(sizeof(r)) ? 0 : 1;
+}
+#endif
+
+// Сколько раз раскрывались файлы (по счётчикам v2) — для files/s
+std::size_t CountFiles(const Corpus& corpus, bool flatten, const fs::path& out_file) {
+    v2::RunStats stats;
+    if (flatten) v2::FlattenProject(corpus.main_file, out_file, corpus.include_dirs, stats);
+    else v2::Preprocess_TZ(corpus.main_file, out_file, corpus.include_dirs, stats);
+    return stats.files.files_read + stats.files.files_replayed;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+#ifdef BENCH_FORK
+    if (argc > 1 && std::strncmp(argv[1], "--child=", 8) == 0) return ChildMain(argc, argv);
+#endif
+    // exec по пути из argv[0] работает, пока текущий каталог тот же
+    g_self = argv[0];
+    int scale = 1;
+    int reps = 3;
+    std::string only;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg.rfind("--scale=", 0) == 0) scale = std::max(1, std::atoi(arg.c_str() + 8));
+        else if (arg.rfind("--reps=", 0) == 0) reps = std::max(1, std::atoi(arg.c_str() + 7));
+        else if (arg.rfind("--only=", 0) == 0) only = arg.substr(7);
+        else {
+            std::cerr << "usage: bench_corpus [--scale=K] [--reps=N] [--only=<corpus>]\n";
+            return 2;
+        }
+    }
+
+    const fs::path root = fs::temp_directory_path() / "bench_corpus";
+    std::error_code ec;
+    fs::remove_all(root, ec);
+
+    using Maker = Corpus (*)(const fs::path&, int);
+    const std::pair<const char*, Maker> makers[] = {
+        {"deep_chain", &DeepChain},
+        {"wide_fanout", [](const fs::path& dir, int k) { return WideFanout(dir, k); }},
+        {"diamonds", &Diamonds},
+        {"many_dirs", &ManyDirs},
+        {"huge_files", &HugeFiles},
+        {"crlf_bom", [](const fs::path& dir, int k) { return WideFanout(dir, k, "\r\n", true, "crlf_bom"); }},
+    };
+
+    bool all_good = true;
+    for (const auto& [name, make] : makers) {
+        if (!only.empty() && only != name) continue;
+        const Corpus corpus = make(root / name, scale);
+
+        std::string reference[2];  // выход v1 в режимах tz / flatten
+        for (std::size_t e = 0; e < std::size(kEngines); ++e) {
+            const Engine& engine = kEngines[e];
+            const fs::path out_file = root / name / (std::string(engine.name) + ".out");
+            Result best;
+            for (int rep = 0; rep < reps; ++rep) {
+                const Result r = Run(e, corpus, out_file);
+                if (rep == 0 || (r.ok && r.ms < best.ms)) best = r;
+            }
+            const std::size_t files = CountFiles(corpus, engine.flatten, root / name / "count.out");
+
+            const std::string output = WithoutBomAndCR(ReadBinary(out_file));
+            std::string& ref = reference[engine.flatten];
+            const bool is_v1 = engine.name[1] == '1';
+            if (is_v1) ref = output;
+            const bool agree = is_v1 || output == ref;
+            all_good = all_good && best.ok && agree;
+
+            const double sec = best.ms / 1000.0;
+            std::cout << "{\"corpus\":\"" << name << "\",\"engine\":\"" << engine.name << "\""
+                      << ",\"ok\":" << (best.ok ? "true" : "false")
+                      << ",\"agree\":" << (agree ? "true" : "false")
+                      << ",\"ms\":" << best.ms
+                      << ",\"out_bytes\":" << best.out_bytes
+                      << ",\"mb_s\":" << (sec > 0 ? best.out_bytes / 1048576.0 / sec : 0.0)
+                      << ",\"files\":" << files
+                      << ",\"files_s\":" << (sec > 0 ? files / sec : 0.0)
+                      << ",\"syscr\":" << best.syscr
+                      << ",\"syscw\":" << best.syscw
+                      << ",\"peak_rss_kb\":" << best.peak_rss_kb << "}\n";
+        }
+        fs::remove_all(root / name, ec);
+    }
+
+    fs::remove_all(root, ec);
+    return all_good ? 0 : 1;
+}
@@ -0,0 +1,145 @@
+// Бенчмарк: старый путь (getline + std::regex_match на каждой строке)
+// против ручного лексера common::FindDirectiveLine / ParseDirectiveLine.
+//
+// g++ -std=gnu++17 -O2 bench/bench_directive_scanner.cpp -o bench_scanner.exe
+// bench_scanner.exe [мегабайт_текста]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../common/directive_scanner.h"
+
+namespace {
+
+struct Hit {
+    std::size_t line_no;
+    common::DirectiveKind kind;
+    std::string token;
+
+    bool operator==(const Hit& o) const {
+        return line_no == o.line_no && kind == o.kind && token == o.token;
+    }
+};
+
+// Строки, на которых легко ошибиться при ручном разборе
+const char* const kTrickyLines[] = {
+    "#include \"a.h\"",
+    "  #  include\t\"dir/b.h\"  \r",
+    "#include<std1.h>",
+    "#   include<dummy.txt>",
+    "#include \"\"",
+    "#include \"a.h\" // comment",
+    "#include <a\"b\">",
+    "#include \"a>b\"",
+    "#include \"unterminated",
+    "#include <unterminated",
+    "#includex \"a.h\"",
+    "#pragma once",
+    "  # pragma   once \r",
+    "#pragmaonce",
+    "#pragma once;",
+    "#define X 1",
+    "#",
+    "int x = a # b;",
+    "    cout << \"#include \\\"x.h\\\"\" << endl;",
+    "\v\f#include \"vf.h\"",
+};
+
+std::string MakeCorpus(std::size_t target_bytes) {
+    std::string text;
+    text.reserve(target_bytes + 256);
+    std::size_t i = 0;
+    while (text.size() < target_bytes) {
+        // ~1% строк — директивы, остальное обычный код
+        if (i % 100 == 0) {
+            text += kTrickyLines[(i / 100) % (sizeof(kTrickyLines) / sizeof(kTrickyLines[0]))];
+        } else if (i % 7 == 0) {
+            text += "    // comment line with some words " + std::to_string(i);
+        } else {
+            text += "    int value_" + std::to_string(i) + " = compute(" + std::to_string(i % 13) + ");";
+        }
+        text += '\n';
+        ++i;
+    }
+    return text;
+}
+
+std::vector<Hit> ScanRegex(const std::string& text) {
+    const std::regex re_quote(R"inc(\s*#\s*include\s*"([^"]*)"\s*)inc", std::regex_constants::optimize);
+    const std::regex re_angle(R"inc(\s*#\s*include\s*<([^>]*)>\s*)inc", std::regex_constants::optimize);
+    const std::regex re_once(R"inc(\s*#\s*pragma\s+once\s*)inc", std::regex_constants::optimize);
+
+    std::vector<Hit> hits;
+    std::istringstream in(text);
+    std::string line;
+    std::size_t line_no = 0;
+    while (std::getline(in, line)) {
+        ++line_no;
+        std::smatch m;
+        if (std::regex_match(line, m, re_quote)) {
+            hits.push_back({line_no, common::DirectiveKind::IncludeQuote, m[1].str()});
+        } else if (std::regex_match(line, m, re_angle)) {
+            hits.push_back({line_no, common::DirectiveKind::IncludeAngle, m[1].str()});
+        } else if (std::regex_match(line, re_once)) {
+            hits.push_back({line_no, common::DirectiveKind::PragmaOnce, ""});
+        }
+    }
+    return hits;
+}
+
+std::vector<Hit> ScanLexer(const std::string& text) {
+    std::vector<Hit> hits;
+    const char* p = text.data();
+    const char* const end = p + text.size();
+    std::size_t line_no = 0;
+    while (p < end) {
+        const char* d = common::FindDirectiveLine(p, end);
+        line_no += common::CountLines(p, d);
+        if (d == end) break;
+        const char* eol = common::FindLineEnd(d, end);
+        ++line_no;
+        const common::Directive dir = common::ParseDirectiveLine({d, static_cast<std::size_t>(eol - d)});
+        if (dir.kind != common::DirectiveKind::None) {
+            hits.push_back({line_no, dir.kind, std::string(dir.token)});
+        }
+        p = eol == end ? end : eol + 1;
+    }
+    return hits;
+}
+
+template <typename F>
+double TimeMs(F&& f) {
+    const auto t0 = std::chrono::steady_clock::now();
+    f();
+    const auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const std::size_t mb = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 16;
+    const std::string text = MakeCorpus(mb * 1024 * 1024);
+
+    std::vector<Hit> by_regex, by_lexer;
+    const double regex_ms = TimeMs([&] { by_regex = ScanRegex(text); });
+    const double lexer_ms = TimeMs([&] { by_lexer = ScanLexer(text); });
+
+    if (!(by_regex == by_lexer)) {
+        std::cerr << "MISMATCH: regex found " << by_regex.size()
+                  << " directives, lexer found " << by_lexer.size() << "\n";
+        return 1;
+    }
+
+    const double mbytes = static_cast<double>(text.size()) / (1024.0 * 1024.0);
+    std::cout << "corpus: " << mbytes << " MB, directives: " << by_lexer.size() << "\n";
+    std::cout << "regex: " << regex_ms << " ms (" << mbytes / (regex_ms / 1000.0) << " MB/s)\n";
+    std::cout << "lexer: " << lexer_ms << " ms (" << mbytes / (lexer_ms / 1000.0) << " MB/s)\n";
+    std::cout << "speedup: x" << regex_ms / lexer_ms << "\n";
+    return 0;
+}
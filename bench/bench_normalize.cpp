@@ -0,0 +1,129 @@
+// Бенчмарк нормализации входа: прежний путь (BOM, memchr, затем RStripCR
+// построчно в новую строку) против NormalizeText за один проход по буферу.
+// Корпуса: чистый LF, CRLF, CRLF в UTF-16LE (прежний путь его не понимал —
+// только время нового). На CRLF результаты обоих сверяются.
+// Текст режется на "файлы" по КБ_на_файл, каждый нормализуется в свою строку,
+// как в FileCache; 0 — один файл на весь текст (тогда время в основном уходит
+// на первое касание страниц свежего буфера, одинаковое у обоих путей).
+//
+// g++ -std=gnu++17 -O2 bench/bench_normalize.cpp -o bench_normalize.exe
+// bench_normalize.exe [мегабайт_текста] [КБ_на_файл] [повторов]    (по умолчанию 64 32 5)
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../v2_parts/v2_source.h"
+
+namespace {
+
+std::string MakeCorpus(std::size_t target_bytes, const char* eol) {
+    std::string text = "\xEF\xBB\xBF";
+    text.reserve(target_bytes + 256);
+    for (std::size_t i = 0; text.size() < target_bytes; ++i) {
+        if (i % 7 == 0) text += "    // comment line with some words " + std::to_string(i);
+        else text += "    int value_" + std::to_string(i) + " = compute(" + std::to_string(i % 13) + ");";
+        text += eol;
+    }
+    return text;
+}
+
+// "Файлы" по file_bytes (0 — весь текст одним файлом)
+std::vector<std::string> Split(const std::string& text, std::size_t file_bytes) {
+    if (file_bytes == 0) file_bytes = text.size();
+    std::vector<std::string> files;
+    for (std::size_t at = 0; at < text.size(); at += file_bytes) files.push_back(text.substr(at, file_bytes));
+    return files;
+}
+
+std::string ToUtf16LE(std::string_view ascii) {
+    v2::StripUtf8BOM(ascii);
+    std::string out = "\xFF\xFE";
+    out.reserve(ascii.size() * 2 + 2);
+    for (char c : ascii) {
+        out += c;
+        out += '\0';
+    }
+    return out;
+}
+
+// Как было в FileCache::Parse до нормализации целого буфера
+std::string_view OldNormalize(std::string_view text, std::string& storage) {
+    v2::StripUtf8BOM(text);
+    if (std::memchr(text.data(), '\r', text.size()) == nullptr) return text;
+    storage.clear();
+    storage.reserve(text.size());
+    while (!text.empty()) {
+        const std::size_t nl = text.find('\n');
+        std::string_view line = text.substr(0, nl);
+        v2::RStripCR(line);
+        storage.append(line.data(), line.size());
+        if (nl == std::string_view::npos) break;
+        storage.push_back('\n');
+        text.remove_prefix(nl + 1);
+    }
+    return storage;
+}
+
+// Лучшее время из reps; каждый файл — в новую строку, как в FileCache
+template <typename F>
+double BestMs(const std::vector<std::string>& files, std::size_t reps, F&& f) {
+    double best = 1e300;
+    for (std::size_t r = 0; r < reps; ++r) {
+        const auto t0 = std::chrono::steady_clock::now();
+        for (const std::string& file : files) {
+            std::string storage;
+            f(file, storage);
+        }
+        best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+    }
+    return best;
+}
+
+void Report(const char* name, std::size_t bytes, double ms) {
+    std::cout << name << ms << " ms, " << bytes / 1048576.0 / (ms / 1000) << " MB/s\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const std::size_t mb = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64;
+    const std::size_t file_kb = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 32;
+    const std::size_t reps = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 5;
+
+    const std::size_t file_bytes = file_kb * 1024;
+    const std::string crlf_text = MakeCorpus(mb * 1024 * 1024, "\r\n");
+    const std::vector<std::string> lf = Split(MakeCorpus(mb * 1024 * 1024, "\n"), file_bytes);
+    const std::vector<std::string> crlf = Split(crlf_text, file_bytes);
+    std::vector<std::string> utf16;
+    for (const std::string& file : crlf) utf16.push_back(ToUtf16LE(file));
+
+    std::size_t sink = 0;  // чтобы компилятор не выбросил работу
+    const auto old_way = [&](std::string_view text, std::string& s) { sink += OldNormalize(text, s).size(); };
+    const auto new_way = [&](std::string_view text, std::string& s) { sink += v2::NormalizeText(text, s).size(); };
+    const std::size_t bytes = mb * 1024 * 1024;
+    std::cout << mb << " MB, files of " << (file_kb ? std::to_string(file_kb) + " KB" : "all") << "\n";
+
+    std::cout << "LF\n";
+    Report("  old:  ", bytes, BestMs(lf, reps, old_way));
+    Report("  new:  ", bytes, BestMs(lf, reps, new_way));
+
+    std::cout << "CRLF\n";
+    Report("  old:  ", bytes, BestMs(crlf, reps, old_way));
+    Report("  new:  ", bytes, BestMs(crlf, reps, new_way));
+
+    std::cout << "UTF-16LE CRLF (MB/s — по байтам UTF-16)\n";
+    Report("  new:  ", 2 * bytes, BestMs(utf16, reps, new_way));
+
+    std::string a, b, c;
+    const std::string whole16 = ToUtf16LE(crlf_text);
+    const bool same = OldNormalize(crlf_text, a) == v2::NormalizeText(crlf_text, b) &&
+                      v2::NormalizeText(whole16, c) == b;
+    std::cout << (same ? "results match" : "RESULTS DIFFER") << " (" << sink << ")\n";
+    return same ? 0 : 1;
+}
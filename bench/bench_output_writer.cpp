@@ -0,0 +1,106 @@
+// Бенчмарк вывода: склейка большого файла тремя способами —
+//   ofstream (как было), writev из отображения, copy_file_range/sendfile.
+// Выход каждого способа сверяется с первым.
+//
+// g++ -std=gnu++17 -O2 bench/bench_output_writer.cpp -o bench_output.exe
+// bench_output.exe [мегабайт_на_файл] [файлов]    (по умолчанию 512 x 4 — 2 ГБ выхода)
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../common/dep_manifest.h"
+#include "../v2_parts/v2_file_cache.h"
+#include "../v2_parts/v2_output.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+enum class Way { Stream, Writev, Splice };
+
+const char* Name(Way way) {
+    switch (way) {
+        case Way::Stream: return "ofstream      ";
+        case Way::Writev: return "writev        ";
+        case Way::Splice: return "copy_file_rng ";
+    }
+    return "";
+}
+
+void MakeFile(const fs::path& file, std::size_t target_bytes) {
+    std::ofstream out(file, std::ios::binary);
+    std::string chunk;
+    for (int i = 0; chunk.size() < (1 << 20); ++i) chunk += "static const int value_" + std::to_string(i) + " = 42;\n";
+    for (std::size_t written = 0; written < target_bytes; written += chunk.size()) out << chunk;
+}
+
+// Все файлы уже разобраны (как в FileCache после первого include) — меряем только вывод
+double Run(Way way, const std::vector<const v2::ParsedFile*>& files, const std::vector<fs::path>& paths,
+           const fs::path& out_file, v2::OutputStats& stats) {
+    const auto t0 = std::chrono::steady_clock::now();
+    if (way == Way::Stream) {
+        std::ofstream out(out_file, std::ios::binary);
+        for (const v2::ParsedFile* file : files) {
+            for (const v2::Segment& seg : file->segments) v2::WriteText(out, seg.text);
+        }
+    } else {
+        v2::OutputWriter out;
+        out.Open(out_file);
+        out.SetSpliceEnabled(way == Way::Splice);
+        for (std::size_t i = 0; i < files.size(); ++i) {
+            const std::string_view whole = files[i]->source.View();
+            for (const v2::Segment& seg : files[i]->segments) {
+                out.WriteTextFromFile(seg.text, paths[i], static_cast<std::uint64_t>(seg.text.data() - whole.data()),
+                                     files[i]->stamp);
+            }
+        }
+        out.Close();
+        stats = out.Stats();
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const std::size_t mb = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 512;
+    const std::size_t count = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4;
+
+    const fs::path dir = fs::temp_directory_path() / "bench_output";
+    fs::create_directories(dir);
+
+    v2::FileCache cache;
+    std::vector<fs::path> paths;
+    std::vector<const v2::ParsedFile*> files;
+    for (std::size_t i = 0; i < count; ++i) {
+        paths.push_back(dir / ("part" + std::to_string(i) + ".h"));
+        MakeFile(paths.back(), mb << 20);
+        files.push_back(cache.Load(paths.back()));
+    }
+
+    const double total_mb = static_cast<double>(mb * count);
+    std::string reference;
+    for (Way way : {Way::Stream, Way::Writev, Way::Splice}) {
+        const fs::path out_file = dir / "out.cpp";
+        v2::OutputStats stats;
+        const double sec = Run(way, files, paths, out_file, stats);
+
+        std::uint64_t hash = 0;
+        if (!common::HashFile(out_file, hash)) return 1;
+        const std::string digest = std::to_string(hash);
+        if (reference.empty()) reference = digest;
+
+        std::cout << Name(way) << sec << " s, " << total_mb / sec << " MB/s, write calls " << stats.write_calls
+                  << ", splice calls " << stats.splice_calls << ", spliced " << (stats.bytes_spliced >> 20) << " MB"
+                  << (digest == reference ? "" : "  ВЫХОД ОТЛИЧАЕТСЯ!") << "\n";
+        fs::remove(out_file);
+    }
+
+    fs::remove_all(dir);
+    return 0;
+}
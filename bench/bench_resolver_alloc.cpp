@@ -0,0 +1,143 @@
+// Бенчмарк выделений памяти в v2: корпус, где одни и те же заголовки
+// подключаются тысячи раз. Глобальный operator new подменён счётчиком.
+//
+// g++ -std=gnu++17 -O2 bench/bench_resolver_alloc.cpp -o bench_alloc.exe
+// bench_alloc.exe [файлов_посередине] [заголовков_в_каждом]    (по умолчанию 100 x 50)
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+#include "../v2_parts/v2_preprocess_impl.h"
+
+namespace {
+std::atomic<std::size_t> g_allocs{0};
+std::atomic<std::size_t> g_alloc_bytes{0};
+
+// Подменённые operator new/delete не встраиваются: иначе GCC видит free() на
+// указателе из new-выражения и предупреждает (-Wmismatched-new-delete)
+#if defined(__GNUC__)
+#define BENCH_NOINLINE __attribute__((noinline))
+#else
+#define BENCH_NOINLINE
+#endif
+
+BENCH_NOINLINE void* CountedAlloc(std::size_t size, std::size_t align) {
+    ++g_allocs;
+    g_alloc_bytes += size;
+    if (size == 0) size = 1;
+#if defined(_WIN32)
+    // _aligned_malloc для всех — освобождение одно, _aligned_free
+    return _aligned_malloc(size, align > alignof(std::max_align_t) ? align : alignof(std::max_align_t));
+#else
+    if (align <= alignof(std::max_align_t)) return std::malloc(size);
+    void* p = nullptr;
+    return posix_memalign(&p, align, size) == 0 ? p : nullptr;
+#endif
+}
+
+BENCH_NOINLINE void CountedFree(void* p) noexcept {
+#if defined(_WIN32)
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void* CountedAllocOrThrow(std::size_t size, std::size_t align) {
+    if (void* p = CountedAlloc(size, align)) return p;
+    throw std::bad_alloc();
+}
+}
+
+// Полный набор, чтобы каждая форма new находила парную delete
+BENCH_NOINLINE void* operator new(std::size_t size) { return CountedAllocOrThrow(size, 0); }
+BENCH_NOINLINE void* operator new[](std::size_t size) { return CountedAllocOrThrow(size, 0); }
+BENCH_NOINLINE void* operator new(std::size_t size, std::align_val_t a) { return CountedAllocOrThrow(size, static_cast<std::size_t>(a)); }
+BENCH_NOINLINE void* operator new[](std::size_t size, std::align_val_t a) { return CountedAllocOrThrow(size, static_cast<std::size_t>(a)); }
+BENCH_NOINLINE void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return CountedAlloc(size, 0); }
+BENCH_NOINLINE void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return CountedAlloc(size, 0); }
+BENCH_NOINLINE void* operator new(std::size_t size, std::align_val_t a, const std::nothrow_t&) noexcept { return CountedAlloc(size, static_cast<std::size_t>(a)); }
+BENCH_NOINLINE void* operator new[](std::size_t size, std::align_val_t a, const std::nothrow_t&) noexcept { return CountedAlloc(size, static_cast<std::size_t>(a)); }
+
+BENCH_NOINLINE void operator delete(void* p) noexcept { CountedFree(p); }
+BENCH_NOINLINE void operator delete[](void* p) noexcept { CountedFree(p); }
+BENCH_NOINLINE void operator delete(void* p, std::size_t) noexcept { CountedFree(p); }
+BENCH_NOINLINE void operator delete[](void* p, std::size_t) noexcept { CountedFree(p); }
+BENCH_NOINLINE void operator delete(void* p, std::align_val_t) noexcept { CountedFree(p); }
+BENCH_NOINLINE void operator delete[](void* p, std::align_val_t) noexcept { CountedFree(p); }
+BENCH_NOINLINE void operator delete(void* p, std::size_t, std::align_val_t) noexcept { CountedFree(p); }
+BENCH_NOINLINE void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { CountedFree(p); }
+BENCH_NOINLINE void operator delete(void* p, const std::nothrow_t&) noexcept { CountedFree(p); }
+BENCH_NOINLINE void operator delete[](void* p, const std::nothrow_t&) noexcept { CountedFree(p); }
+BENCH_NOINLINE void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { CountedFree(p); }
+BENCH_NOINLINE void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { CountedFree(p); }
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// main.cpp -> mid/m<i>.h (mids штук) -> "../common/h<k>.h" и <lib/l<k>.h> (heads штук)
+void MakeCorpus(const fs::path& root, int mids, int heads) {
+    fs::remove_all(root);
+    fs::create_directories(root / "mid");
+    fs::create_directories(root / "common");
+    fs::create_directories(root / "inc" / "lib");
+
+    std::ofstream main_file(root / "main.cpp");
+    for (int i = 0; i < mids; ++i) {
+        main_file << "#include \"mid/m" << i << ".h\"\n";
+        std::ofstream mid(root / "mid" / ("m" + std::to_string(i) + ".h"));
+        for (int k = 0; k < heads; ++k) {
+            mid << "#include \"../common/h" << k << ".h\"\n"
+                << "#include <lib/l" << k << ".h>\n";
+        }
+    }
+    main_file << "int main() {}\n";
+    for (int k = 0; k < heads; ++k) {
+        std::ofstream(root / "common" / ("h" + std::to_string(k) + ".h")) << "int h" << k << ";\n";
+        std::ofstream(root / "inc" / "lib" / ("l" + std::to_string(k) + ".h")) << "int l" << k << ";\n";
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const int mids = argc > 1 ? std::atoi(argv[1]) : 100;
+    const int heads = argc > 2 ? std::atoi(argv[2]) : 50;
+
+    const fs::path root = fs::temp_directory_path() / "bench_alloc";
+    MakeCorpus(root, mids, heads);
+    const std::vector<fs::path> include_dirs = {root / "inc"};
+
+    for (int run = 0; run < 2; ++run) {
+        const bool flatten = run == 1;
+        v2::RunStats stats;
+        const std::size_t allocs0 = g_allocs, bytes0 = g_alloc_bytes;
+        const auto t0 = std::chrono::steady_clock::now();
+        const bool ok = flatten
+            ? v2::FlattenProject(root / "main.cpp", root / "out.cpp", include_dirs, stats)
+            : v2::Preprocess_TZ(root / "main.cpp", root / "out.cpp", include_dirs, stats);
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        const std::size_t allocs = g_allocs - allocs0, bytes = g_alloc_bytes - bytes0;
+
+        std::cout << (flatten ? "flatten" : "tz     ") << " ok=" << ok << " lookups=" << stats.resolver.lookups
+                  << " allocs=" << allocs << " alloc_bytes=" << bytes
+                  << " allocs/lookup=" << (stats.resolver.lookups ? double(allocs) / stats.resolver.lookups : 0.0)
+                  << " ms=" << ms << "\n";
+    }
+
+    fs::remove_all(root);
+    return 0;
+}
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <system_error>
+
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace common {
+namespace fs = std::filesystem;
+
+// =======================
+// Вывод "только если изменился": результат сверяется с прежним файлом по ходу
+// записи, и пока совпадает, на диск не пишется ничего. На первом отличии
+// заводится временный файл рядом (совпавшее начало копируется в него), в конце
+// он заменяет прежний через rename — атомарно, без полузаписанного файла.
+// Не изменился — прежний файл и его mtime остаются, и make/ccache/V0 не
+// пересобирают то, что от него зависит.
+// =======================
+
+// Имя временного файла рядом с target: rename в пределах каталога атомарен.
+// Уникально по процессу и вызову — два потока не делят один временный файл.
+inline fs::path TempPathFor(const fs::path& target) {
+    static std::atomic<unsigned> counter{0};
+#if defined(_WIN32)
+    const long long pid = _getpid();
+#else
+    const long long pid = ::getpid();
+#endif
+    fs::path temp = target;
+    temp += ".tmp" + std::to_string(pid) + "_" + std::to_string(counter++);
+    return temp;
+}
+
+// Выход — ссылка на файл: меняем сам файл, а не подменяем ссылку обычным файлом
+inline fs::path ReplaceTarget(const fs::path& target) {
+    std::error_code ec;
+    if (!fs::is_symlink(target, ec)) return target;
+    fs::path real = fs::canonical(target, ec);
+    return ec ? target : real;
+}
+
+// temp -> target; права — как у прежнего файла. false — temp удалён, target прежний.
+inline bool ReplaceFile(const fs::path& temp, const fs::path& target, bool keep_permissions) {
+    std::error_code ec;
+    if (keep_permissions) {
+        const fs::perms perms = fs::status(target, ec).permissions();
+        if (!ec) fs::permissions(temp, perms, ec);
+    }
+    fs::rename(temp, target, ec);
+    if (!ec) return true;
+    fs::remove(temp, ec);
+    return false;
+}
+
+class ChangedFileBuf final : public std::streambuf {
+public:
+    ChangedFileBuf() = default;
+    ChangedFileBuf(const ChangedFileBuf&) = delete;
+    ChangedFileBuf& operator=(const ChangedFileBuf&) = delete;
+    ~ChangedFileBuf() override { Discard(); }
+
+    // false — вывод не создать (нет каталога и т.п.)
+    bool Open(const fs::path& target) {
+        Discard();
+        target_ = ReplaceTarget(target);
+        temp_path_ = TempPathFor(target_);
+        open_ = true;
+        changed_ = false;
+        same_ = 0;
+        put_ = 0;
+        old_pos_ = 0;
+        old_buf_.clear();
+
+        std::error_code ec;
+        const fs::file_status st = fs::status(target_, ec);
+        if (fs::exists(st) && !fs::is_regular_file(st)) {
+            // /dev/stdout, FIFO: сравнивать не с чем и заменять нечего — пишем как есть
+            direct_ = true;
+            changed_ = true;
+            temp_.open(target_, std::ios::binary | std::ios::trunc);
+            return temp_.is_open();
+        }
+        direct_ = false;
+        old_.open(target_, std::ios::binary);
+        had_old_ = comparing_ = old_.is_open();
+        return comparing_ || Diverge();
+    }
+
+    // Конец вывода: отличается от прежнего — заменить его, иначе не трогать.
+    // false — не записалось (прежний файл при этом цел).
+    bool Commit() {
+        if (!open_) return true;
+        open_ = false;
+        if (comparing_) {
+            char probe;
+            const bool old_longer = old_pos_ < old_buf_.size() || old_.read(&probe, 1).gcount() > 0;
+            if (!old_longer) {
+                old_.close();
+                comparing_ = false;
+                return true;  // ни байта не записано
+            }
+            if (!Diverge()) return false;
+        }
+        temp_.close();
+        if (direct_) return !temp_.fail();
+        std::error_code ec;
+        if (temp_.fail()) {
+            fs::remove(temp_path_, ec);
+            return false;
+        }
+        return ReplaceFile(temp_path_, target_, had_old_);
+    }
+
+    // Вывод не нужен (прогон не удался): прежний файл остаётся как был
+    void Discard() {
+        if (!open_) return;
+        open_ = false;
+        old_.close();
+        const bool had_temp = temp_.is_open();
+        temp_.close();
+        std::error_code ec;
+        if (had_temp && !direct_) fs::remove(temp_path_, ec);
+    }
+
+    // После Commit: файл переписан (или создан)
+    bool Changed() const { return changed_; }
+
+protected:
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        Put(s, static_cast<std::size_t>(n));
+        return n;
+    }
+
+    // Только tellp(): сколько байт выведено
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode) override {
+        if (off != 0 || dir != std::ios_base::cur) return pos_type(off_type(-1));
+        return pos_type(static_cast<off_type>(put_));
+    }
+
+    int_type overflow(int_type ch) override {
+        if (traits_type::eq_int_type(ch, traits_type::eof())) return traits_type::not_eof(ch);
+        const char c = traits_type::to_char_type(ch);
+        Put(&c, 1);
+        return ch;
+    }
+
+private:
+    static constexpr std::size_t kChunk = 64 * 1024;
+
+    void Put(const char* data, std::size_t n) {
+#if defined(_WIN32)
+        // как у ofstream в текстовом режиме: '\n' -> "\r\n"
+        while (n > 0) {
+            const char* nl = static_cast<const char*>(std::memchr(data, '\n', n));
+            const std::size_t len = nl ? static_cast<std::size_t>(nl - data) : n;
+            PutRaw(data, len);
+            if (!nl) break;
+            PutRaw("\r\n", 2);
+            data += len + 1;
+            n -= len + 1;
+        }
+#else
+        PutRaw(data, n);
+#endif
+    }
+
+    void PutRaw(const char* data, std::size_t n) {
+        put_ += n;
+        while (comparing_ && n > 0) {
+            if (old_pos_ == old_buf_.size()) {
+                old_buf_.resize(kChunk);
+                old_.read(old_buf_.data(), static_cast<std::streamsize>(kChunk));
+                old_buf_.resize(static_cast<std::size_t>(old_.gcount()));
+                old_pos_ = 0;
+                if (old_buf_.empty()) {
+                    Diverge();  // прежний файл короче
+                    break;
+                }
+            }
+            const std::size_t k = std::min(n, old_buf_.size() - old_pos_);
+            if (std::memcmp(data, old_buf_.data() + old_pos_, k) != 0) {
+                Diverge();
+                break;
+            }
+            old_pos_ += k;
+            same_ += k;
+            data += k;
+            n -= k;
+        }
+        if (n > 0) temp_.write(data, static_cast<std::streamsize>(n));
+    }
+
+    // Дальше — во временный файл; совпавшее начало прежнего файла копируется туда
+    bool Diverge() {
+        comparing_ = false;
+        changed_ = true;
+        temp_.open(temp_path_, std::ios::binary | std::ios::trunc);
+        if (!temp_.is_open()) {
+            temp_.setstate(std::ios::failbit);
+            return false;
+        }
+        if (same_ > 0) {
+            old_.clear();
+            old_.seekg(0);
+            std::string chunk(kChunk, '\0');
+            for (std::uint64_t left = same_; left > 0 && old_;) {
+                const std::size_t k = static_cast<std::size_t>(std::min<std::uint64_t>(left, kChunk));
+                old_.read(chunk.data(), static_cast<std::streamsize>(k));
+                temp_.write(chunk.data(), old_.gcount());
+                left -= static_cast<std::uint64_t>(old_.gcount());
+                if (static_cast<std::size_t>(old_.gcount()) != k) temp_.setstate(std::ios::failbit);  // прежний файл укоротили
+            }
+        }
+        old_.close();
+        return static_cast<bool>(temp_);
+    }
+
+    fs::path target_;
+    fs::path temp_path_;
+    std::ifstream old_;
+    std::ofstream temp_;
+    std::string old_buf_;          // текущий кусок прежнего файла
+    std::size_t old_pos_ = 0;      // сколько из него уже сверено
+    std::uint64_t same_ = 0;       // байт совпало с начала
+    std::uint64_t put_ = 0;        // байт выведено
+    bool open_ = false;
+    bool comparing_ = false;       // пока всё совпадает
+    bool had_old_ = false;
+    bool direct_ = false;
+    bool changed_ = false;
+};
+
+// То же как std::ostream — замена std::ofstream out(out_file)
+class ChangedFile final : public std::ostream {
+public:
+    ChangedFile() : std::ostream(nullptr) { rdbuf(&buf_); }
+    explicit ChangedFile(const fs::path& target) : ChangedFile() { Open(target); }
+
+    bool Open(const fs::path& target) {
+        clear();
+        if (!buf_.Open(target)) setstate(std::ios::failbit);
+        return good();
+    }
+
+    bool Commit() { return buf_.Commit() && good(); }
+    void Discard() { buf_.Discard(); }
+    bool Changed() const { return buf_.Changed(); }
+
+private:
+    ChangedFileBuf buf_;
+};
+
+} // namespace common
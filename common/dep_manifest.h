@@ -0,0 +1,191 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace common {
+namespace fs = std::filesystem;
+
+// =======================
+// Сайдкар-манифест зависимостей: "<out>.deps" рядом с результатом.
+// Если ни один файл графа include не изменился — повторный прогон не нужен.
+// =======================
+//
+// Формат (текст, путь всегда в конце строки):
+//   depcache 1
+//   tool <версия инструмента>
+//   mode <flatten|tz>
+//   written <тики file_time_type на начало прогона, до первого чтения>
+//   input <путь>
+//   include_dir <путь>                    (по порядку)
+//   output <size> <mtime> <hash>
+//   file <size> <mtime> <hash> <путь>     (каждый прочитанный файл, снят до чтения)
+//   absent <путь>                         (кандидаты include, которых не было)
+
+struct FileStamp {
+    std::uintmax_t size = 0;
+    long long mtime = 0;
+    std::uint64_t hash = 0;
+};
+
+struct DepManifest {
+    std::string tool;  // меняется, когда меняется поведение склейки
+    std::string mode;
+    fs::path input;
+    std::vector<fs::path> include_dirs;
+
+    std::vector<fs::path> files;   // всё, что было прочитано
+    std::vector<fs::path> absent;  // новый файл здесь мог бы перекрыть найденный include
+
+    // Снимки files, сделанные до чтения (по одному на каждый files[i]) — не
+    // после склейки: правка посреди прогона тогда видна следующему прогону
+    // как изменение, а не записывается в манифест против старого выхода.
+    std::vector<FileStamp> stamps;
+    long long started = 0;  // тики file_time_type до первого снимка
+};
+
+inline long long FileClockNow() {
+    return static_cast<long long>(fs::file_time_type::clock::now().time_since_epoch().count());
+}
+
+inline fs::path DepManifestPath(const fs::path& out_file) {
+    return fs::path(out_file.string() + ".deps");
+}
+
+// FNV-1a 64 — нам нужна не криптостойкость, а дешёвое сравнение содержимого
+inline bool HashFile(const fs::path& file, std::uint64_t& hash) {
+    std::ifstream in(file, std::ios::binary);
+    if (!in.is_open()) return false;
+    hash = 1469598103934665603ull;
+    char buf[1 << 16];
+    while (in.read(buf, sizeof(buf)) || in.gcount() > 0) {
+        for (std::streamsize i = 0; i < in.gcount(); ++i) {
+            hash ^= static_cast<unsigned char>(buf[i]);
+            hash *= 1099511628211ull;
+        }
+    }
+    return true;
+}
+
+inline bool StampFile(const fs::path& file, FileStamp& stamp, bool with_hash) {
+    std::error_code ec;
+    stamp.size = fs::file_size(file, ec);
+    if (ec) return false;
+    stamp.mtime = static_cast<long long>(fs::last_write_time(file, ec).time_since_epoch().count());
+    if (ec) return false;
+    return !with_hash || HashFile(file, stamp.hash);
+}
+
+// false — манифест не записан (в том числе снимков не столько, сколько файлов)
+inline bool WriteDepManifest(const fs::path& out_file, const DepManifest& m) {
+    if (m.stamps.size() != m.files.size()) return false;
+    std::ostringstream text;
+    text << "depcache 1\n"
+         << "tool " << m.tool << "\n"
+         << "mode " << m.mode << "\n"
+         << "written " << m.started << "\n"
+         << "input " << m.input.string() << "\n";
+    for (const auto& dir : m.include_dirs) text << "include_dir " << dir.string() << "\n";
+
+    FileStamp st;
+    if (!StampFile(out_file, st, true)) return false;
+    text << "output " << st.size << " " << st.mtime << " " << st.hash << "\n";
+
+    // файл прочитан не раз — берём первый снимок: изменился после него — пересклеим
+    std::map<fs::path, FileStamp> files;
+    for (std::size_t i = 0; i < m.files.size(); ++i) files.emplace(m.files[i], m.stamps[i]);
+    for (const auto& [file, stamp] : files) {
+        text << "file " << stamp.size << " " << stamp.mtime << " " << stamp.hash << " " << file.string() << "\n";
+    }
+    const std::set<fs::path> absent(m.absent.begin(), m.absent.end());
+    for (const auto& path : absent) text << "absent " << path.string() << "\n";
+
+    std::ofstream out(DepManifestPath(out_file), std::ios::binary);
+    out << text.str();
+    return static_cast<bool>(out);
+}
+
+namespace detail {
+
+// Файл не изменился: размер тот же и либо mtime тот же (и не "гоночный" —
+// не в пределах 2 с от начала прогона, где точности mtime нельзя верить),
+// либо, если mtime сдвинулся/ненадёжен, совпадает хеш содержимого.
+inline bool StampUnchanged(const fs::path& file, const FileStamp& recorded, long long written) {
+    FileStamp now;
+    if (!StampFile(file, now, false)) return false;
+    if (now.size != recorded.size) return false;
+
+    using namespace std::chrono;
+    const long long racy_window = duration_cast<fs::file_time_type::duration>(seconds(2)).count();
+    if (now.mtime == recorded.mtime && recorded.mtime + racy_window < written) return true;
+
+    return HashFile(file, now.hash) && now.hash == recorded.hash;
+}
+
+inline std::string RestOfLine(std::istringstream& fields) {
+    std::string rest;
+    std::getline(fields >> std::ws, rest);
+    return rest;
+}
+
+} // namespace detail
+
+// true — манифест есть, заголовок (tool/mode/input/include_dirs) совпадает
+// с expected, выход и все зависимости на месте и не менялись.
+inline bool DepManifestUpToDate(const fs::path& out_file, const DepManifest& expected) {
+    std::ifstream in(DepManifestPath(out_file), std::ios::binary);
+    if (!in.is_open()) return false;
+
+    std::string line;
+    if (!std::getline(in, line) || line != "depcache 1") return false;
+
+    long long written = 0;
+    std::vector<fs::path> dirs;
+    bool header_ok = false;
+    bool output_seen = false;
+
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string kind;
+        fields >> kind;
+
+        if (kind == "tool") {
+            if (detail::RestOfLine(fields) != expected.tool) return false;
+        } else if (kind == "mode") {
+            if (detail::RestOfLine(fields) != expected.mode) return false;
+        } else if (kind == "written") {
+            fields >> written;
+        } else if (kind == "input") {
+            if (fs::path(detail::RestOfLine(fields)) != expected.input) return false;
+            header_ok = true;
+        } else if (kind == "include_dir") {
+            dirs.push_back(fs::path(detail::RestOfLine(fields)));
+        } else if (kind == "output") {
+            if (dirs != expected.include_dirs) return false;
+            FileStamp rec;
+            if (!(fields >> rec.size >> rec.mtime >> rec.hash)) return false;
+            if (!detail::StampUnchanged(out_file, rec, written)) return false;
+            output_seen = true;
+        } else if (kind == "file") {
+            FileStamp rec;
+            if (!(fields >> rec.size >> rec.mtime >> rec.hash)) return false;
+            if (!detail::StampUnchanged(fs::path(detail::RestOfLine(fields)), rec, written)) return false;
+        } else if (kind == "absent") {
+            std::error_code ec;
+            if (fs::exists(fs::path(detail::RestOfLine(fields)), ec)) return false;
+        } else {
+            return false;
+        }
+    }
+    return header_ok && output_seen;
+}
+
+} // namespace common
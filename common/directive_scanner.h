@@ -0,0 +1,128 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+
+namespace common {
+
+// =======================
+// Ручной лексер директив (вместо std::regex на каждой строке)
+// =======================
+//
+// Повторяет ровно то, что раньше делали regex_match по шаблонам
+//   \s*#\s*include\s*"([^"]*)"\s*
+//   \s*#\s*include\s*<([^>]*)>\s*
+//   \s*#\s*pragma\s+once\s*
+// но без regex: 99% строк не начинаются с '#', и их мы пропускаем memchr'ом
+// по всему буферу, не разбивая файл на строки.
+
+enum class DirectiveKind {
+    None,          // обычная строка (или '#'-строка, которая нам не интересна)
+    IncludeQuote,  // #include "..."
+    IncludeAngle,  // #include <...>
+    PragmaOnce,    // #pragma once
+};
+
+struct Directive {
+    DirectiveKind kind = DirectiveKind::None;
+    std::string_view token;  // для include: то, что между "" или <>
+};
+
+// \s из std::regex (C-локаль): ' ', \t, \n, \v, \f, \r.
+// \r здесь важен: строка "#include \"a.h\"\r" из CRLF-файла — это include.
+inline bool IsDirectiveSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+namespace detail {
+
+inline std::size_t SkipSpaces(std::string_view s, std::size_t i) {
+    while (i < s.size() && IsDirectiveSpace(s[i])) ++i;
+    return i;
+}
+
+inline bool OnlySpacesFrom(std::string_view s, std::size_t i) {
+    return SkipSpaces(s, i) == s.size();
+}
+
+inline bool StartsWithAt(std::string_view s, std::size_t i, std::string_view word) {
+    return s.size() - i >= word.size() && s.compare(i, word.size(), word) == 0;
+}
+
+} // namespace detail
+
+// Разбирает одну строку (без завершающего '\n').
+inline Directive ParseDirectiveLine(std::string_view line) {
+    using namespace detail;
+
+    std::size_t i = SkipSpaces(line, 0);
+    if (i == line.size() || line[i] != '#') return {};
+    i = SkipSpaces(line, i + 1);
+
+    if (StartsWithAt(line, i, "include")) {
+        i = SkipSpaces(line, i + 7);
+        if (i == line.size()) return {};
+
+        const char open = line[i];
+        const char close = open == '"' ? '"' : open == '<' ? '>' : '\0';
+        if (close == '\0') return {};
+
+        const std::size_t tok_begin = i + 1;
+        const std::size_t tok_end = line.find(close, tok_begin);
+        if (tok_end == std::string_view::npos) return {};
+        if (!OnlySpacesFrom(line, tok_end + 1)) return {};
+
+        return {open == '"' ? DirectiveKind::IncludeQuote : DirectiveKind::IncludeAngle,
+                line.substr(tok_begin, tok_end - tok_begin)};
+    }
+
+    if (StartsWithAt(line, i, "pragma")) {
+        i += 6;
+        // \s+ : хотя бы один пробел между pragma и once
+        if (i == line.size() || !IsDirectiveSpace(line[i])) return {};
+        i = SkipSpaces(line, i);
+        if (!StartsWithAt(line, i, "once")) return {};
+        if (!OnlySpacesFrom(line, i + 4)) return {};
+        return {DirectiveKind::PragmaOnce, {}};
+    }
+
+    return {};
+}
+
+// Ищет в [p, end) начало следующей строки, у которой первый непробельный
+// символ — '#'. p обязан указывать на начало строки. Если такой строки нет,
+// возвращает end. Всё, что не содержит '#', проходится memchr'ом (он в libc
+// векторизован), поэтому обычный код пропускается со скоростью памяти.
+inline const char* FindDirectiveLine(const char* p, const char* end) {
+    while (p < end) {
+        const void* hit = std::memchr(p, '#', static_cast<std::size_t>(end - p));
+        if (!hit) return end;
+        const char* hash = static_cast<const char*>(hit);
+
+        // назад до начала строки: допустимы только пробелы (отступ)
+        const char* ls = hash;
+        while (ls > p && ls[-1] != '\n' && IsDirectiveSpace(ls[-1])) --ls;
+        if (ls == p || ls[-1] == '\n') return ls;
+
+        // '#' в середине строки — прыгаем на следующую строку
+        const void* nl = std::memchr(hash, '\n', static_cast<std::size_t>(end - hash));
+        if (!nl) return end;
+        p = static_cast<const char*>(nl) + 1;
+    }
+    return end;
+}
+
+// Конец строки, начинающейся в p (указатель на '\n' или end).
+inline const char* FindLineEnd(const char* p, const char* end) {
+    const void* nl = std::memchr(p, '\n', static_cast<std::size_t>(end - p));
+    return nl ? static_cast<const char*>(nl) : end;
+}
+
+// Сколько строк (символов '\n') в [p, end).
+inline std::size_t CountLines(const char* p, const char* end) {
+    return static_cast<std::size_t>(std::count(p, end, '\n'));
+}
+
+} // namespace common
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace common {
+
+// =======================
+// Цикл include: файл подключает сам себя через цепочку других.
+// Движки держат множество файлов на стеке (по каноническому пути) и
+// останавливаются на первом повторе, печатая цепочку целиком.
+// =======================
+
+// Звено цепочки: в файле file на строке line стоит include следующего звена
+struct IncludeEdge {
+    std::string file;
+    std::size_t line = 0;
+};
+
+// "include cycle: a.h:1 -> b.h:2 -> a.h"; пути — через '/' в любой ОС (generic_string)
+inline void WriteIncludeCycle(std::ostream& out,
+                              const std::vector<IncludeEdge>& chain,
+                              const std::string& repeated,
+                              const char* what = "include cycle") {
+    out << what << ": ";
+    for (const IncludeEdge& edge : chain) out << edge.file << ":" << edge.line << " -> ";
+    out << repeated << "\n";
+}
+
+} // namespace common
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include "directive_scanner.h"
+
+namespace common {
+namespace fs = std::filesystem;
+
+// =======================
+// Include-once для flatten: #pragma once и классические include guard'ы
+// =======================
+
+// Один и тот же файл, подключённый через разные пути ("a/../b.h", "b.h", симлинк),
+// должен давать один ключ.
+inline std::string FileIdentity(const fs::path& file) {
+    std::error_code ec;
+    fs::path canon = fs::weakly_canonical(file, ec);
+    if (ec) canon = fs::absolute(file, ec).lexically_normal();
+    return canon.string();
+}
+
+namespace detail {
+
+inline std::size_t SkipSpacesAndComments(std::string_view s, std::size_t i) {
+    for (;;) {
+        while (i < s.size() && IsDirectiveSpace(s[i])) ++i;
+        if (s.compare(i, 2, "//") == 0) {
+            const std::size_t nl = s.find('\n', i);
+            if (nl == std::string_view::npos) return s.size();
+            i = nl + 1;
+            continue;
+        }
+        if (s.compare(i, 2, "/*") == 0) {
+            const std::size_t close = s.find("*/", i + 2);
+            if (close == std::string_view::npos) return s.size();
+            i = close + 2;
+            continue;
+        }
+        return i;
+    }
+}
+
+inline bool IsIdentChar(char c) {
+    return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+}
+
+// "#  ifndef  NAME ..." -> keyword="ifndef", arg="NAME". line — без '\n'.
+inline void SplitDirective(std::string_view line, std::string_view& keyword, std::string_view& arg) {
+    keyword = {};
+    arg = {};
+    std::size_t i = SkipSpaces(line, 0);
+    if (i == line.size() || line[i] != '#') return;
+    i = SkipSpaces(line, i + 1);
+    std::size_t k = i;
+    while (k < line.size() && IsIdentChar(line[k])) ++k;
+    keyword = line.substr(i, k - i);
+    i = SkipSpaces(line, k);
+    k = i;
+    while (k < line.size() && IsIdentChar(line[k])) ++k;
+    arg = line.substr(i, k - i);
+}
+
+inline std::string_view LineAt(std::string_view s, std::size_t i) {
+    const std::size_t nl = s.find('\n', i);
+    return s.substr(i, nl == std::string_view::npos ? std::string_view::npos : nl - i);
+}
+
+// Блочный комментарий или сырая строка, открытые в [from, to), не закрыты до to:
+// строка с to тогда не директива, а их часть. Обычные литералы и // не
+// разбираем — "/*" в строке тоже считается; ошибка только в сторону "не guard".
+inline bool LongRegionCrosses(std::string_view s, std::size_t from, std::size_t to) {
+    while (from < to) {
+        const std::size_t comment = s.substr(0, to).find("/*", from);
+        const std::size_t raw = s.substr(0, to).find("R\"", from);
+        if (comment == std::string_view::npos && raw == std::string_view::npos) return false;
+        if (comment < raw) {
+            const std::size_t close = s.find("*/", comment + 2);
+            if (close == std::string_view::npos || close >= to) return true;
+            from = close + 2;
+            continue;
+        }
+        // R"delim( ... )delim"; не похоже на сырую строку — идём дальше
+        const std::size_t open = s.substr(0, raw + 2 + 17).find('(', raw + 2);  // разделитель — до 16 символов
+        const std::string_view delim = s.substr(raw + 2, open == std::string_view::npos ? 0 : open - raw - 2);
+        if (open == std::string_view::npos || delim.find_first_of(" )\\\t\n\"") != std::string_view::npos) {
+            from = raw + 2;
+            continue;
+        }
+        const std::size_t close = s.find(")" + std::string(delim) + "\"", open + 1);
+        if (close == std::string_view::npos || close >= to) return true;
+        from = close + delim.size() + 2;
+    }
+    return false;
+}
+
+} // namespace detail
+
+// Весь файл (кроме комментариев и пробелов) обёрнут в
+//   #ifndef X
+//   #define X
+//   ...
+//   #endif
+// и парный #endif — последняя значимая строка, без #else/#elif между ними:
+// иначе при повторном include компилятор взял бы другую ветку.
+inline bool HasIncludeGuard(std::string_view text) {
+    using namespace detail;
+
+    std::size_t i = SkipSpacesAndComments(text, 0);
+    if (i == text.size() || text[i] != '#') return false;
+
+    std::string_view keyword, guard;
+    SplitDirective(LineAt(text, i), keyword, guard);
+    if (keyword != "ifndef" || guard.empty()) return false;
+
+    i += LineAt(text, i).size();
+    i = SkipSpacesAndComments(text, i);
+    if (i == text.size() || text[i] != '#') return false;
+
+    std::string_view def_keyword, def_name;
+    SplitDirective(LineAt(text, i), def_keyword, def_name);
+    if (def_keyword != "define" || def_name != guard) return false;
+
+    // дальше считаем вложенность #if.../#endif; парный #endif должен быть последним
+    const char* p = text.data() + i + LineAt(text, i).size();
+    const char* const end = text.data() + text.size();
+    std::size_t checked = static_cast<std::size_t>(p - text.data());  // до сюда длинных областей нет
+    int depth = 1;
+    while (p < end) {
+        const char* d = FindDirectiveLine(p, end);
+        if (d == end) break;
+        const char* eol = FindLineEnd(d, end);
+        p = eol == end ? end : eol + 1;
+
+        // "директива" внутри /* */ или R"(...)" — вложенность не узнать, не guard
+        const std::size_t at = static_cast<std::size_t>(d - text.data());
+        if (LongRegionCrosses(text, checked, at)) return false;
+        checked = at;
+
+        std::string_view kw, arg;
+        SplitDirective({d, static_cast<std::size_t>(eol - d)}, kw, arg);
+        if (kw == "if" || kw == "ifdef" || kw == "ifndef") {
+            ++depth;
+        } else if (depth == 1 && (kw == "else" || kw == "elif" || kw == "elifdef" || kw == "elifndef")) {
+            return false;
+        } else if (kw == "endif") {
+            if (--depth == 0) {
+                // после "#endif" допускаем только комментарий на той же строке
+                const std::size_t after_kw = static_cast<std::size_t>(kw.data() + kw.size() - text.data());
+                return SkipSpacesAndComments(text, after_kw) == text.size();
+            }
+        }
+    }
+    return false;
+}
+
+inline bool HasPragmaOnce(std::string_view text) {
+    const char* p = text.data();
+    const char* const end = p + text.size();
+    while (p < end) {
+        const char* d = FindDirectiveLine(p, end);
+        if (d == end) return false;
+        const char* eol = FindLineEnd(d, end);
+        if (ParseDirectiveLine({d, static_cast<std::size_t>(eol - d)}).kind == DirectiveKind::PragmaOnce) return true;
+        p = eol == end ? end : eol + 1;
+    }
+    return false;
+}
+
+// Файл достаточно вставить в склейку один раз
+inline bool IsIncludeOnce(std::string_view text) {
+    return HasPragmaOnce(text) || HasIncludeGuard(text);
+}
+
+} // namespace common
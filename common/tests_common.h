@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cassert>
+#include <chrono>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -8,6 +9,8 @@
 #include <string>
 #include <vector>
 
+#include "include_once.h"
+
 namespace common {
 namespace fs = std::filesystem;
 
@@ -129,12 +132,144 @@ inline void TestSample(PreprocessFn fn) {
     assert(GetFileContents("sources/a.in") == expected.str());
 }
 
-inline void RunAllTests(const char* /*version_name*/, PreprocessFn fn) {
+// Выход переписывается, только если изменился: тот же результат — файл и его
+// mtime прежние; неудачная склейка прежний выход не трогает; временных файлов не остаётся
+inline void TestOutputWriteIfChanged(PreprocessFn flatten) {
+    std::error_code err;
+    fs::remove_all("sources_out", err);
+    fs::create_directories("sources_out", err);
+    std::ofstream("sources_out/main.cpp") << "#include \"a.h\"\n// main\n";
+    std::ofstream("sources_out/a.h") << "// a\n";
+    const fs::path in("sources_out/main.cpp"), out("sources_out/main.out");
+
+    assert(flatten(in, out, {}));
+    assert(GetFileContents(out) == "// a\n// main\n");
+    const fs::file_time_type old_time = fs::last_write_time(out) - std::chrono::hours(1);
+    fs::last_write_time(out, old_time);
+    assert(flatten(in, out, {}));
+    assert(fs::last_write_time(out) == old_time);
+
+    // длиннее, короче, отличие посередине — переписывается
+    for (const std::string a : {"// a\n// more\n", "", "// b\n"}) {
+        std::ofstream("sources_out/a.h") << a;
+        assert(flatten(in, out, {}));
+        assert(GetFileContents(out) == a + "// main\n");
+    }
+    assert(fs::last_write_time(out) != old_time);
+
+    std::ofstream("sources_out/a.h") << "#include \"missing.h\"\n";
+    CoutCapture cap;
+    cap.Begin();
+    const bool ok = flatten(in, out, {});
+    cap.End();
+    assert(!ok);
+    assert(GetFileContents(out) == "// b\n// main\n");
+
+    std::size_t files = 0;
+    for (auto it = fs::directory_iterator("sources_out"); it != fs::directory_iterator(); ++it) ++files;
+    assert(files == 3);
+}
+
+// Flatten: файлы с #pragma once и include guard вставляются один раз
+// (даже если подключены через другой путь), обычные — каждый раз.
+inline void TestFlattenIncludeOnce(PreprocessFn flatten) {
+    std::error_code err;
+    fs::remove_all("sources_once", err);
+    fs::create_directories(fs::path("sources_once") / "sub", err);
+
+    {
+        std::ofstream file("sources_once/main.cpp");
+        file << "#include \"a.h\"\n"
+             << "#include \"g.h\"\n"
+             << "#include \"a.h\"\n"
+             << "#include \"sub/../g.h\"\n"
+             << "#include \"plain.h\"\n"
+             << "#include \"plain.h\"\n"
+             << "int main() {}\n";
+    }
+    {
+        std::ofstream file("sources_once/a.h");
+        file << "#pragma once\n"
+             << "// a\n";
+    }
+    const std::string guarded = "// guard comment\n"
+                                "#ifndef G_H\n"
+                                "#define G_H\n"
+                                "#ifdef X\n"
+                                "// x\n"
+                                "#endif\n"
+                                "// g\n"
+                                "#endif // G_H\n";
+    {
+        std::ofstream file("sources_once/g.h");
+        file << guarded;
+    }
+    {
+        std::ofstream file("sources_once/plain.h");
+        file << "// plain\n";
+    }
+
+    bool ok = flatten(fs::path("sources_once/main.cpp"), fs::path("sources_once/main.flat"), {});
+    assert(ok);
+    assert(GetFileContents("sources_once/main.flat") == "// a\n" + guarded + "// plain\n// plain\nint main() {}\n");
+
+    // не guard: #else у внешнего #ifndef; #endif внутри комментария или сырой строки
+    assert(!HasIncludeGuard("#ifndef G\n#define G\n#else\nint x;\n#endif\n"));
+    assert(!HasIncludeGuard("#ifndef G\n#define G\n#elif 1\nint x;\n#endif\n"));
+    assert(!HasIncludeGuard("#ifndef G\n#define G\n/*\n#endif\n*/\nint x;\n#endif\n"));
+    assert(!HasIncludeGuard("#ifndef G\n#define G\nauto s = R\"x(\n#endif\n)x\";\n#endif\n"));
+    assert(HasIncludeGuard("#ifndef G\n#define G\n#if A\n#else\n#endif\n/* c */ auto s = R\"(a)\";\n#endif\n"));
+}
+
+// Цепочка include намного длиннее прежнего предела глубины (200) раскрывается целиком
+inline void TestDeepIncludeChain(PreprocessFn fn) {
+    constexpr int kDepth = 3000;
+    std::error_code err;
+    fs::remove_all("sources_deep", err);
+    fs::create_directories("sources_deep", err);
+
+    for (int i = 0; i < kDepth; ++i) {
+        std::ofstream file("sources_deep/h" + std::to_string(i) + ".h");
+        if (i + 1 < kDepth) file << "#include \"h" << i + 1 << ".h\"\n";
+        file << "// " << i << "\n";
+    }
+    std::string reversed;
+    for (int i = kDepth - 1; i >= 0; --i) reversed += "// " + std::to_string(i) + "\n";
+
+    bool ok = fn(fs::path("sources_deep/h0.h"), fs::path("sources_deep/out.txt"), {});
+    assert(ok);
+    assert(GetFileContents("sources_deep/out.txt") == reversed);
+}
+
+// Цикл include: прогон останавливается на первом повторе и печатает цепочку
+// (a.h в цикл не входит — цепочка начинается с b.h)
+inline void TestIncludeCycle(PreprocessFn fn) {
+    std::error_code err;
+    fs::remove_all("sources_cycle", err);
+    fs::create_directories("sources_cycle", err);
+    std::ofstream("sources_cycle/a.h") << "// a\n#include \"b.h\"\n";
+    std::ofstream("sources_cycle/b.h") << "#include \"c.h\"\n";
+    std::ofstream("sources_cycle/c.h") << "// c\n\n#include \"b.h\"\n";
+
+    CoutCapture cap;
+    cap.Begin();
+    const bool ok = fn(fs::path("sources_cycle/a.h"), fs::path("sources_cycle/out.txt"), {});
+    const std::string captured = cap.End();
+
+    assert(!ok);
+    assert(captured == "include cycle: sources_cycle/b.h:1 -> sources_cycle/c.h:3 -> sources_cycle/b.h\n");
+}
+
+// Дополнительные тесты конкретной версии (выполняются после общих)
+using ExtraTestsFn = void(*)();
+
+inline void RunAllTests(const char* /*version_name*/, PreprocessFn fn, ExtraTestsFn extra = nullptr) {
     // "как в тренажёре"
     std::cout << "Анализируем и компилируем решение...\n";
     std::cout << "Запускаем тесты...\n";
 
     TestSample(fn);
+    if (extra) extra();
 
     std::cout << "Успех!\n";
 }
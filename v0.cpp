@@ -1,14 +1,36 @@
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
 #include <cstdlib>
 #include <filesystem>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
+
+#include "v1_parts/v1_flatten_cached.h"
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
 
 using namespace std;
 namespace fs = std::filesystem;
 
-static int Run(const string& cmd) {
-    cout << cmd << endl;
-    return system(cmd.c_str());
+// Шаги идут параллельно, поэтому вывод команды (stdout и stderr) собирается
+// в log и печатается целиком, когда шаг закончится
+static int Run(const string& cmd, string& log) {
+    log += cmd + "\n";
+    FILE* pipe = popen((cmd + " 2>&1").c_str(), "r");
+    if (!pipe) return -1;
+    char buf[4096];
+    size_t n = 0;
+    while ((n = fread(buf, 1, sizeof(buf), pipe)) > 0) log.append(buf, n);
+    return pclose(pipe);
 }
 
 static void EnsureDir(const fs::path& p) {
@@ -16,40 +38,142 @@ static void EnsureDir(const fs::path& p) {
     fs::create_directories(p, ec);
 }
 
+// target есть и не старше source — пересобирать не нужно
+static bool UpToDate(const fs::path& target, const fs::path& source) {
+    std::error_code ec1, ec2;
+    const auto target_time = fs::last_write_time(target, ec1);
+    const auto source_time = fs::last_write_time(source, ec2);
+    return !ec1 && !ec2 && target_time >= source_time;
+}
+
+// =======================
+// Сборка — граф шагов: шаг запускается, как только готовы все его зависимости,
+// независимые шаги идут одновременно. Шаг, чья зависимость провалилась, пропускается.
+// =======================
+
+struct Step {
+    string name;
+    vector<size_t> deps;                 // номера шагов, которые должны пройти раньше
+    function<bool(string& log)> action;  // false — шаг провален
+    string error;                        // что напечатать в stderr при провале
+
+    enum class State { Waiting, Running, Done, Failed, Skipped } state = State::Waiting;
+    double ms = 0;      // длительность шага
+    double end_ms = 0;  // когда закончился, от начала сборки
+};
+
+// true — все шаги прошли
+static bool RunSteps(vector<Step>& steps) {
+    using Clock = chrono::steady_clock;
+    const auto start = Clock::now();
+    auto since = [](Clock::time_point from) {
+        return chrono::duration<double, milli>(Clock::now() - from).count();
+    };
+
+    mutex m;
+    condition_variable finished;
+    size_t running = 0;
+    vector<thread> threads;
+
+    unique_lock lock(m);
+    for (;;) {
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (size_t i = 0; i < steps.size(); ++i) {
+                Step& step = steps[i];
+                if (step.state != Step::State::Waiting) continue;
+                bool ready = true, blocked = false;
+                for (size_t d : step.deps) {
+                    const Step::State s = steps[d].state;
+                    if (s == Step::State::Failed || s == Step::State::Skipped) blocked = true;
+                    if (s != Step::State::Done) ready = false;
+                }
+                if (blocked) {
+                    step.state = Step::State::Skipped;
+                    changed = true;
+                } else if (ready) {
+                    step.state = Step::State::Running;
+                    ++running;
+                    threads.emplace_back([&, i] {
+                        Step& me = steps[i];
+                        string log;
+                        const auto t0 = Clock::now();
+                        const bool ok = me.action(log);
+                        const double ms = since(t0);
+
+                        lock_guard done(m);
+                        me.ms = ms;
+                        me.end_ms = since(start);
+                        me.state = ok ? Step::State::Done : Step::State::Failed;
+                        cout << log << "[" << me.name << "] " << ms << " ms" << endl;
+                        if (!ok) cerr << me.error << "\n";
+                        --running;
+                        finished.notify_all();
+                    });
+                }
+            }
+        }
+        if (running == 0) break;
+        finished.wait(lock);
+    }
+    lock.unlock();
+    for (auto& t : threads) t.join();
+
+    bool all_ok = true;
+    double sum_ms = 0;
+    for (const Step& step : steps) {
+        sum_ms += step.ms;
+        if (step.state == Step::State::Skipped) cout << "[" << step.name << "] пропущен" << endl;
+        if (step.state != Step::State::Done) all_ok = false;
+    }
+    cout << "сборка: " << since(start) << " ms (шаги по очереди заняли бы " << sum_ms << " ms)" << endl;
+    return all_ok;
+}
+
 int main() {
     // ВАЖНО: консоль Windows часто в CP866. В README добавляем "chcp 65001".
 
     EnsureDir("build");
 
+    enum : size_t { kBuildV1, kTestV1, kFlattenV2, kBuildV2, kTestV2 };
+    vector<Step> steps(5);
+
     // 1) Собираем V1
-    if (Run("g++ -std=gnu++17 v1_parts/v1_main.cpp -o v1.exe") != 0) {
-        cerr << "Ошибка! Не удалось собрать V1\n";
-        return 1;
-    }
+    steps[kBuildV1] = {"сборка V1", {}, [](string& log) {
+        return Run("g++ -std=gnu++17 v1_parts/v1_main.cpp -o v1.exe", log) == 0;
+    }, "Ошибка! Не удалось собрать V1"};
 
     // 2) Запускаем V1 (тесты)
-    if (Run("v1.exe") != 0) {
-        cerr << "Ошибка! Тесты V1 провалены\n";
-        return 1;
-    }
+    steps[kTestV1] = {"тесты V1", {kBuildV1}, [](string& log) {
+        return Run("v1.exe", log) == 0;
+    }, "Ошибка! Тесты V1 провалены"};
 
-    // 3) V1 склеивает V2 (flatten: раскрываем только #include "...")
-    if (Run("v1.exe --flatten v2_parts/v2_main.cpp build/v2_flat.cpp v2_parts common") != 0) {
-        cerr << "Ошибка! V1 не смог склеить V2\n";
-        return 1;
-    }
+    // 3) V1 склеивает V2 (flatten: раскрываем только #include "...") — здесь же,
+    //    в процессе: движок V1 собран в v0.exe, ждать v1.exe не нужно
+    steps[kFlattenV2] = {"склейка V2", {}, [](string& log) {
+        log += "v1 --flatten v2_parts/v2_main.cpp build/v2_flat.cpp v2_parts common\n";
+        ostringstream messages;
+        const bool ok = v1::FlattenIfChanged("v2_parts/v2_main.cpp", "build/v2_flat.cpp",
+                                             {fs::path("v2_parts"), fs::path("common")}, messages);
+        log += messages.str();
+        return ok;
+    }, "Ошибка! V1 не смог склеить V2"};
 
     // 4) Собираем V2 из build/v2_flat.cpp
-    if (Run("g++ -std=gnu++17 build/v2_flat.cpp -o v2.exe") != 0) {
-        cerr << "Ошибка! Не удалось собрать V2 (v2_flat.cpp)\n";
-        return 1;
-    }
+    //    (V1 не переписывает v2_flat.cpp, если исходники не менялись —
+    //     тогда и v2.exe собирать заново незачем)
+    steps[kBuildV2] = {"сборка V2", {kFlattenV2}, [](string& log) {
+        if (UpToDate("v2.exe", "build/v2_flat.cpp")) {
+            log += "v2.exe актуален, компиляцию пропускаем\n";
+            return true;
+        }
+        return Run("g++ -std=gnu++17 -pthread build/v2_flat.cpp -o v2.exe", log) == 0;
+    }, "Ошибка! Не удалось собрать V2 (v2_flat.cpp)"};
 
-    // 5) Запускаем V2 (тесты)
-    if (Run("v2.exe") != 0) {
-        cerr << "Ошибка! Тесты V2 провалены\n";
-        return 1;
-    }
+    // 5) Запускаем V2 (тесты). После тестов V1: те и другие пишут в sources*/.
+    steps[kTestV2] = {"тесты V2", {kBuildV2, kTestV1}, [](string& log) {
+        return Run("v2.exe", log) == 0;
+    }, "Ошибка! Тесты V2 провалены"};
 
-    return 0;
+    return RunSteps(steps) ? 0 : 1;
 }
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <filesystem>
+#include <ostream>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "../common/dep_manifest.h"
+#include "v1_preprocess_impl.h"
+
+namespace v1 {
+namespace fs = std::filesystem;
+
+// =======================
+// --flatten с манифестом зависимостей: то, что делает `v1.exe --flatten`.
+// Отдельно от main, чтобы V0 мог склеивать V2 у себя в процессе.
+// =======================
+
+// Ничего из графа include не менялось — выход не трогаем. Сообщения
+// (те же, что печатает v1.exe, и ошибки склейки) пишутся в log. false — склейка не удалась.
+inline bool FlattenIfChanged(const fs::path& in_file,
+                             const fs::path& out_file,
+                             const std::vector<fs::path>& include_dirs,
+                             std::ostream& log) {
+    common::DepManifest deps{"v1-flatten-1", "flatten", in_file, include_dirs, {}, {}, {}, 0};
+    if (common::DepManifestUpToDate(out_file, deps)) {
+        log << "flatten: " << out_file.string() << " актуален, пропускаем\n";
+        return true;
+    }
+
+    FlattenState state;
+    state.stamp_reads = true;
+    deps.started = common::FileClockNow();
+    bool ok = FlattenProject(in_file, out_file, include_dirs, state, log);
+    if (ok && state.once_skipped > 0) {
+        log << "include-once: пропущено повторных include: " << state.once_skipped
+            << ", сэкономлено байт: " << state.bytes_saved << "\n";
+    }
+    if (ok && !state.output_changed) {
+        log << "flatten: " << out_file.string() << " совпал с прежним, файл не тронут\n";
+    }
+
+    std::error_code ec;
+    fs::remove(common::DepManifestPath(out_file), ec);
+    if (ok && state.stamps_ok) {
+        deps.files = std::move(state.read_files);
+        deps.stamps = std::move(state.read_stamps);
+        deps.absent = std::move(state.absent);
+        common::WriteDepManifest(out_file, deps);
+    }
+    return ok;
+}
+
+} // namespace v1
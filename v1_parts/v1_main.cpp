@@ -4,6 +4,7 @@
 #include <vector>
 
 #include "../common/tests_common.h"
+#include "v1_flatten_cached.h"
 #include "v1_preprocess_impl.h"
 
 namespace fs = std::filesystem;
@@ -16,7 +17,14 @@ int main(int argc, char** argv) {
     if (argc == 1) {
     	
     	std::cout << "V1: минимальная реализация + flatten (только #include \"...\")\n";
-        common::RunAllTests("V1", &v1::Preprocess);
+        common::RunAllTests("V1", &v1::Preprocess, [] {
+            common::TestFlattenIncludeOnce(&v1::FlattenProject);
+            common::TestDeepIncludeChain(&v1::Preprocess);
+            common::TestDeepIncludeChain(&v1::FlattenProject);
+            common::TestIncludeCycle(&v1::Preprocess);
+            common::TestIncludeCycle(&v1::FlattenProject);
+            common::TestOutputWriteIfChanged(&v1::FlattenProject);
+        });
         return 0;
     }
 
@@ -33,7 +41,7 @@ int main(int argc, char** argv) {
         std::vector<fs::path> include_dirs;
         for (int i = 4; i < argc; ++i) include_dirs.push_back(fs::path(argv[i]));
 
-        bool ok = v1::FlattenProject(in_file, out_file, include_dirs);
+        bool ok = v1::FlattenIfChanged(in_file, out_file, include_dirs, std::cout);
         return ok ? 0 : 1;
     }
 
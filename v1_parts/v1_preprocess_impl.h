@@ -2,89 +2,168 @@
 
 #include <filesystem>
 #include <fstream>
-#include <functional>
 #include <iostream>
-#include <regex>
+#include <iterator>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include "../common/changed_file.h"
+#include "../common/dep_manifest.h"
+#include "../common/directive_scanner.h"
+#include "../common/include_cycle.h"
+#include "../common/include_once.h"
+
 namespace v1 {
 namespace fs = std::filesystem;
 
+// Читаем файл целиком (тем же текстовым потоком, что раньше читал getline)
+inline std::string ReadWholeFile(std::ifstream& in) {
+    return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+}
+
+// Строка текста + '\n' — как раньше делал out << line << '\n'
+inline void WriteLine(std::ostream& out, const char* begin, const char* end) {
+    out.write(begin, end - begin);
+    out << '\n';
+}
+
 // =======================
 // РЕЖИМ 1 (ТЗ): раскрываем и "..." и <...> по include_directories
 // =======================
 
-inline bool PreprocessOne_TZ(const fs::path& in_file,
-                            std::ostream& out,
-                            const std::vector<fs::path>& include_directories) {
-    std::ifstream in(in_file);
+// Файл, раскрытие которого ещё не закончено: текст целиком и место, где остановились.
+// Поток к этому моменту уже закрыт — открыт только файл на вершине стека, и то
+// лишь пока читается.
+struct OpenFile {
+    fs::path file;
+    std::string text;
+    std::size_t pos = 0;  // смещение в text
+    int line_num = 0;
+    // Путь без "." и "..": ключ поиска циклов. Без обращений к ФС — цена include
+    // та же; один файл под разными написаниями пути даёт разные ключи, но
+    // написаний конечное число, и цикл всё равно найдётся — на круг позже.
+    std::string stack_key;
+
+    // flatten: include-once
+    std::string identity;
+    std::streamoff start_pos = -1;
+};
+
+inline bool ReadOpenFile(const fs::path& file, OpenFile& frame) {
+    std::ifstream in(file);
     if (!in) return false;
+    frame.file = file;
+    frame.text = ReadWholeFile(in);
+    frame.stack_key = file.generic_string();
+    // нормализуем, только если есть что: "./", "/." в пути
+    const std::string& key = frame.stack_key;
+    if (key.find("/.") != std::string::npos || key.rfind(".", 0) == 0) {
+        frame.stack_key = file.lexically_normal().generic_string();
+    }
+    return true;
+}
 
-    static std::regex incl_quotes{R"inc(\s*#\s*include\s*"([^"]*)"\s*)inc"};
-    static std::regex incl_angle {R"inc(\s*#\s*include\s*<([^>]*)>\s*)inc"};
-	
-    std::string line;
-    int line_num = 0;
+// Файлы на стеке. Повторный вход в такой файл — цикл: он не кончится.
+class OnStack {
+public:
+    explicit OnStack(std::ostream& log) : log_(log) {}
 
-    while (std::getline(in, line)) {
-        ++line_num;
-    
-        std::smatch m;
+    // false — next уже раскрывается: печатает цепочку от первого его вхождения в log
+    bool Push(const std::vector<OpenFile>& stack, const OpenFile& next) {
+        if (keys_.insert(next.stack_key).second) return true;
+        std::vector<common::IncludeEdge> chain;
+        bool in_cycle = false;
+        for (const OpenFile& frame : stack) {
+            in_cycle = in_cycle || frame.stack_key == next.stack_key;
+            if (in_cycle) chain.push_back({frame.file.generic_string(), static_cast<std::size_t>(frame.line_num)});
+        }
+        common::WriteIncludeCycle(log_, chain, next.file.generic_string());
+        log_.flush();
+        return false;
+    }
 
-        // #include "..."
-        if (std::regex_match(line, m, incl_quotes)) {
-            const std::string token = m[1].str();
-            const fs::path rel = fs::path(token);
+    void Pop(const OpenFile& frame) { keys_.erase(frame.stack_key); }
 
-            // 1) рядом с текущим файлом, 2) include_directories
-            std::vector<fs::path> candidates;
-            candidates.push_back(in_file.parent_path() / rel);
-            for (const auto& dir : include_directories) candidates.push_back(dir / rel);
+private:
+    std::ostream& log_;
+    std::unordered_set<std::string> keys_;
+};
 
-            bool ok = false;
-            for (const auto& cand : candidates) {
-                std::ifstream test(cand);
-                if (test) {
-                    if (!PreprocessOne_TZ(cand, out, include_directories)) return false;
-                    ok = true;
-                    break;
-                }
-            }
-            if (!ok) {
-                std::cout << "unknown include file " << token
-                          << " at file " << in_file.string()
-                          << " at line " << line_num << std::endl;
-                return false;
-            }
+// Сообщения об ошибках (цикл, ненайденный include) — в log
+inline bool PreprocessOne_TZ(const fs::path& in_file,
+                            std::ostream& out,
+                            const std::vector<fs::path>& include_directories,
+                            std::ostream& log = std::cout) {
+    // явный стек вместо рекурсии: глубина цепочки include не ограничена стеком вызовов
+    std::vector<OpenFile> stack(1);
+    if (!ReadOpenFile(in_file, stack.back())) return false;
+    OnStack on_stack(log);
+    on_stack.Push({}, stack.back());
+
+    while (!stack.empty()) {
+        OpenFile& top = stack.back();
+        const char* const begin = top.text.data();
+        const char* p = begin + top.pos;
+        const char* const end = begin + top.text.size();
+        if (p >= end) {
+            on_stack.Pop(top);
+            stack.pop_back();
             continue;
         }
 
-        // #include <...>  (в ТЗ-режиме ищем по include_directories)
-        if (std::regex_match(line, m, incl_angle)) {
-            const std::string token = m[1].str();
+        // строки без директив копируем одним куском
+        const char* d = common::FindDirectiveLine(p, end);
+        top.line_num += static_cast<int>(common::CountLines(p, d));
+        if (d == end) {
+            if (end[-1] != '\n') WriteLine(out, p, end);
+            else out.write(p, end - p);
+            top.pos = top.text.size();
+            continue;
+        }
+        out.write(p, d - p);
+
+        const char* eol = common::FindLineEnd(d, end);
+        ++top.line_num;
+        top.pos = eol == end ? top.text.size() : static_cast<std::size_t>(eol + 1 - begin);
+
+        const common::Directive directive = common::ParseDirectiveLine({d, static_cast<std::size_t>(eol - d)});
+
+        if (directive.kind == common::DirectiveKind::IncludeQuote ||
+            directive.kind == common::DirectiveKind::IncludeAngle) {
+            const std::string token(directive.token);
             const fs::path rel = fs::path(token);
 
+            // "...": 1) рядом с текущим файлом, 2) include_directories
+            // <...>: в ТЗ-режиме только include_directories
+            std::vector<fs::path> candidates;
+            if (directive.kind == common::DirectiveKind::IncludeQuote) candidates.push_back(top.file.parent_path() / rel);
+            for (const auto& dir : include_directories) candidates.push_back(dir / rel);
+
             bool ok = false;
-            for (const auto& dir : include_directories) {
-                fs::path cand = dir / rel;
+            for (const auto& cand : candidates) {
                 std::ifstream test(cand);
                 if (test) {
-                    if (!PreprocessOne_TZ(cand, out, include_directories)) return false;
+                    OpenFile next;
+                    if (!ReadOpenFile(cand, next)) return false;
+                    if (!on_stack.Push(stack, next)) return false;
+                    stack.push_back(std::move(next));  // top дальше недействителен
                     ok = true;
                     break;
                 }
             }
             if (!ok) {
-                std::cout << "unknown include file " << token
-                          << " at file " << in_file.string()
-                          << " at line " << line_num << std::endl;
+                log << "unknown include file " << token
+                    << " at file " << top.file.string()
+                    << " at line " << top.line_num << std::endl;
                 return false;
             }
             continue;
         }
 
-        out << line << '\n';
+        WriteLine(out, d, eol);
     }
 
     return true;
@@ -97,60 +176,132 @@ inline bool Preprocess(const fs::path& in_file,
     std::ifstream probe(in_file);
     if (!probe) return false;
 
-    std::ofstream out(out_file);
+    // out переписывается, только если результат другой (common/changed_file.h)
+    common::ChangedFile out(out_file);
     if (!out) return false;
 
-    return PreprocessOne_TZ(in_file, out, include_directories);
+    // ТЗ: и при ошибке в out остаётся всё, что записано до неё
+    const bool ok = PreprocessOne_TZ(in_file, out, include_directories);
+    return out.Commit() && ok;
 }
 
 // =======================
 // РЕЖИМ 2 (FLATTEN): раскрываем только "..." , а <...> оставляем как есть
 // =======================
 
+// Что уже вставлено в склейку: файлы с #pragma once / include guard
+// вставляются один раз, повторные include пропускаются.
+struct FlattenState {
+    std::unordered_map<std::string, std::streamoff> once_emitted;  // identity -> байт при первой вставке
+    std::size_t once_skipped = 0;
+    std::streamoff bytes_saved = 0;
+
+    // для манифеста зависимостей (common/dep_manifest.h)
+    std::vector<fs::path> read_files;  // все прочитанные файлы
+    std::vector<fs::path> absent;      // кандидаты include, которых не оказалось
+    bool stamp_reads = false;                     // снимать read_files до чтения
+    std::vector<common::FileStamp> read_stamps;   // по одному на read_files[i]
+    bool stamps_ok = true;                        // false — какой-то снимок не снялся
+
+    bool output_changed = true;  // FlattenProject: выход переписан (а не совпал с прежним)
+};
+
+// Кладёт файл на стек; include-once файл, который уже вставлен, пропускается
+// (стек не растёт). false — файл не открылся или зациклился.
+inline bool EnterFlatten(const fs::path& file, std::ostream& out, std::vector<OpenFile>& stack,
+                         OnStack& on_stack, FlattenState& state) {
+    OpenFile frame;
+    common::FileStamp stamp;
+    if (state.stamp_reads && !common::StampFile(file, stamp, true)) state.stamps_ok = false;
+    if (!ReadOpenFile(file, frame)) return false;
+    state.read_files.push_back(file);
+    if (state.stamp_reads) state.read_stamps.push_back(stamp);
+
+    if (common::IsIncludeOnce(frame.text)) {
+        frame.identity = common::FileIdentity(file);
+        if (auto it = state.once_emitted.find(frame.identity); it != state.once_emitted.end()) {
+            ++state.once_skipped;
+            state.bytes_saved += it->second;
+            return true;
+        }
+        state.once_emitted.emplace(frame.identity, 0);
+    }
+    if (!on_stack.Push(stack, frame)) return false;
+    frame.start_pos = out.tellp();
+    stack.push_back(std::move(frame));
+    return true;
+}
+
 inline bool PreprocessOne_Flatten(const fs::path& in_file,
                                  std::ostream& out,
-                                 const std::vector<fs::path>& include_directories) {
-    std::ifstream in(in_file);
-    if (!in) return false;
+                                 const std::vector<fs::path>& include_directories,
+                                 FlattenState& state,
+                                 std::ostream& log = std::cout) {
+    std::vector<OpenFile> stack;
+    OnStack on_stack(log);
+    if (!EnterFlatten(in_file, out, stack, on_stack, state)) return false;
 
-    static std::regex incl_quotes{R"inc(\s*#\s*include\s*"([^"]*)"\s*)inc"};
-    static std::regex incl_angle {R"inc(\s*#\s*include\s*<([^>]*)>\s*)inc"};
-    static const std::regex pragma_once_re(R"inc(\s*#\s*pragma\s+once\s*)inc");
+    while (!stack.empty()) {
+        OpenFile& top = stack.back();
+        const char* const begin = top.text.data();
+        const char* p = begin + top.pos;
+        const char* const end = begin + top.text.size();
+        if (p >= end) {
+            if (!top.identity.empty() && top.start_pos >= 0) {
+                state.once_emitted[top.identity] = out.tellp() - top.start_pos;
+            }
+            on_stack.Pop(top);
+            stack.pop_back();
+            continue;
+        }
 
-    std::string line;
-    int line_num = 0;
+        const char* d = common::FindDirectiveLine(p, end);
+        top.line_num += static_cast<int>(common::CountLines(p, d));
+        if (d == end) {
+            if (end[-1] != '\n') WriteLine(out, p, end);
+            else out.write(p, end - p);
+            top.pos = top.text.size();
+            continue;
+        }
+        out.write(p, d - p);
+
+        const char* eol = common::FindLineEnd(d, end);
+        ++top.line_num;
+        top.pos = eol == end ? top.text.size() : static_cast<std::size_t>(eol + 1 - begin);
+
+        const common::Directive directive = common::ParseDirectiveLine({d, static_cast<std::size_t>(eol - d)});
 
-    while (std::getline(in, line)) {
-        ++line_num;
-        
         // убираем #pragma once при flatten (чтобы не было warning в итоговом .cpp)
-	    if (std::regex_match(line, pragma_once_re)) {
-	        continue;
-	    }
-    
-        std::smatch m;
-
-        if (std::regex_match(line, m, incl_quotes)) {
-            const std::string token = m[1].str();
+        if (directive.kind == common::DirectiveKind::PragmaOnce) {
+            continue;
+        }
+
+        if (directive.kind == common::DirectiveKind::IncludeQuote) {
+            const std::string token(directive.token);
             const fs::path rel = fs::path(token);
 
             std::vector<fs::path> candidates;
-            candidates.push_back(in_file.parent_path() / rel);
+            candidates.push_back(top.file.parent_path() / rel);
             for (const auto& dir : include_directories) candidates.push_back(dir / rel);
 
+            // top может стать недействительным в EnterFlatten — всё нужное копируем заранее
+            const fs::path current = top.file;
+            const int line_num = top.line_num;
+
             bool ok = false;
             for (const auto& cand : candidates) {
                 std::ifstream test(cand);
                 if (test) {
-                    if (!PreprocessOne_Flatten(cand, out, include_directories)) return false;
+                    if (!EnterFlatten(cand, out, stack, on_stack, state)) return false;
                     ok = true;
                     break;
                 }
+                state.absent.push_back(cand);
             }
             if (!ok) {
-                std::cout << "unknown include file " << token
-                          << " at file " << in_file.string()
-                          << " at line " << line_num << std::endl;
+                log << "unknown include file " << token
+                    << " at file " << current.string()
+                    << " at line " << line_num << std::endl;
                 return false;
             }
             continue;
@@ -158,27 +309,50 @@ inline bool PreprocessOne_Flatten(const fs::path& in_file,
 
         // КЛЮЧЕВОЕ ПРАВИЛО FLATTEN:
         // <...> не раскрываем, оставляем компилятору.
-        if (std::regex_match(line, m, incl_angle)) {
-            out << line << '\n';
+        if (directive.kind == common::DirectiveKind::IncludeAngle) {
+            WriteLine(out, d, eol);
             continue;
         }
 
-        out << line << '\n';
+        WriteLine(out, d, eol);
     }
 
     return true;
 }
 
+inline bool PreprocessOne_Flatten(const fs::path& in_file,
+                                 std::ostream& out,
+                                 const std::vector<fs::path>& include_directories) {
+    FlattenState state;
+    return PreprocessOne_Flatten(in_file, out, include_directories, state);
+}
+
 inline bool FlattenProject(const fs::path& in_file,
                            const fs::path& out_file,
-                           const std::vector<fs::path>& include_directories) {
+                           const std::vector<fs::path>& include_directories,
+                           FlattenState& state,
+                           std::ostream& log = std::cout) {
     std::ifstream probe(in_file);
     if (!probe) return false;
 
-    std::ofstream out(out_file);
+    // Склейка не удалась — прежний out не трогаем; удалась, но та же — тоже
+    common::ChangedFile out(out_file);
     if (!out) return false;
 
-    return PreprocessOne_Flatten(in_file, out, include_directories);
+    if (!PreprocessOne_Flatten(in_file, out, include_directories, state, log)) {
+        out.Discard();
+        return false;
+    }
+    const bool written = out.Commit();
+    state.output_changed = out.Changed();
+    return written;
+}
+
+inline bool FlattenProject(const fs::path& in_file,
+                           const fs::path& out_file,
+                           const std::vector<fs::path>& include_directories) {
+    FlattenState state;
+    return FlattenProject(in_file, out_file, include_directories, state);
 }
 
 } // namespace v1
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <istream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "v2_preprocess_impl.h"
+
+namespace v2 {
+namespace fs = std::filesystem;
+
+// =======================
+// BATCH: много пар <in> <out> за один запуск, пул потоков и общие кэши
+// =======================
+
+struct BatchJob {
+    fs::path in_file;
+    fs::path out_file;
+
+    bool ok = false;
+    RunStats stats;
+    std::string messages;  // то, что одиночный запуск напечатал бы в std::cout
+};
+
+struct BatchWorkerReport {
+    std::size_t jobs = 0;
+    double busy_ms = 0;
+};
+
+struct BatchReport {
+    double wall_ms = 0;
+    std::size_t ok = 0;
+    std::size_t failed = 0;
+    std::vector<BatchWorkerReport> workers;
+};
+
+// Манифест: по паре "<in_file> <out_file>" на строку; пустые строки и
+// строки, начинающиеся с '#', пропускаются. false — битая строка (см. error).
+inline bool ReadBatchManifest(std::istream& in, std::vector<BatchJob>& jobs, std::string& error) {
+    std::string line;
+    std::size_t line_no = 0;
+    while (std::getline(in, line)) {
+        ++line_no;
+        RStripCR(line);
+        std::istringstream fields(line);
+        std::string in_file, out_file, extra;
+        if (!(fields >> in_file) || in_file[0] == '#') continue;
+        if (!(fields >> out_file) || (fields >> extra)) {
+            error = "bad manifest line " + std::to_string(line_no) + ": " + line;
+            return false;
+        }
+        BatchJob job;
+        job.in_file = in_file;
+        job.out_file = out_file;
+        jobs.push_back(std::move(job));
+    }
+    return true;
+}
+
+// Каждая пара обрабатывается ровно как одиночный Preprocess/FlattenProject
+// с теми же options (вывод побайтно тот же), но все потоки делят caches.
+// threads == 0 — по числу ядер. Параллельность — по парам: options.jobs
+// не используется; system_header тоже (один заголовок на много выводов
+// не годится) — пролог --hoist-system пишется в начало каждого вывода.
+inline BatchReport RunBatch(std::vector<BatchJob>& jobs,
+                            Mode mode,
+                            SharedCaches& caches,
+                            const RunOptions& options,
+                            unsigned threads = 0) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast<unsigned>(std::min<std::size_t>(threads, std::max<std::size_t>(jobs.size(), 1)));
+
+    using Clock = std::chrono::steady_clock;
+    const auto start = Clock::now();
+
+    BatchReport report;
+    report.workers.resize(threads);
+    std::atomic<std::size_t> next{0};
+    RunOptions job_options = options;
+    job_options.jobs = 1;
+    job_options.system_header.clear();
+
+    auto worker = [&](BatchWorkerReport& me) {
+        for (std::size_t i = next++; i < jobs.size(); i = next++) {
+            const auto t0 = Clock::now();
+            BatchJob& job = jobs[i];
+            std::ostringstream log;
+            job.ok = detail::ExpandProject(job.in_file, job.out_file, mode, job_options, caches, job.stats, log);
+            job.messages = log.str();
+            ++me.jobs;
+            me.busy_ms += std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; ++t) pool.emplace_back(worker, std::ref(report.workers[t]));
+    worker(report.workers[0]);
+    for (auto& th : pool) th.join();
+
+    report.wall_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    for (const BatchJob& job : jobs) ++(job.ok ? report.ok : report.failed);
+    return report;
+}
+
+inline BatchReport RunBatch(std::vector<BatchJob>& jobs,
+                            const std::vector<fs::path>& include_directories,
+                            Mode mode,
+                            const RunOptions& options,
+                            unsigned threads = 0) {
+    SharedCaches caches(include_directories);
+    return RunBatch(jobs, mode, caches, options, threads);
+}
+
+} // namespace v2
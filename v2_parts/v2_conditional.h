@@ -0,0 +1,610 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "../common/directive_scanner.h"
+
+namespace v2 {
+
+// =======================
+// Условная компиляция (по желанию, RunOptions::conditional): таблица макросов
+// из -D и #define/#undef, условия #if/#ifdef/#ifndef/#elif/#else/#endif.
+// include в заведомо неактивной ветке не раскрывается.
+// =======================
+//
+// Правило одно: ветку пропускаем, только если точно знаем, что она неактивна.
+// Чего не понять без настоящего препроцессора (вызов function-like макроса,
+// неизвестное имя с "__" в начале — это обычно макросы компилятора вроде
+// __cplusplus/__GNUC__, — битое выражение), то "не знаю": такая ветка
+// раскрывается, как раньше, и #else после неё — тоже. #define/#undef в такой
+// ветке (или под ней) мог сработать, а мог и нет: имя становится "может быть
+// определено", и всё, что от него зависит, — тоже "не знаю".
+
+enum class CondKind { If, Ifdef, Ifndef, Elif, Else, Endif, Define, Undef };
+
+// '#'-строка условной компиляции. Строки с '\' в конце склеены:
+// text — от '#' до конца последней строки.
+struct CondDirective {
+    CondKind kind = CondKind::If;
+    std::string_view text;
+    std::string_view rest;  // после ключевого слова: условие или "ИМЯ тело"
+};
+
+namespace detail {
+
+inline bool IsIdentStart(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+inline bool IsIdentChar(char c) {
+    return IsIdentStart(c) || (c >= '0' && c <= '9');
+}
+
+} // namespace detail
+
+// line — строка-директива целиком (с продолжениями). false — не наша директива.
+inline bool ParseCondDirective(std::string_view line, CondDirective& d) {
+    std::size_t i = common::detail::SkipSpaces(line, 0);
+    if (i == line.size() || line[i] != '#') return false;
+    i = common::detail::SkipSpaces(line, i + 1);
+    std::size_t end = i;
+    while (end < line.size() && detail::IsIdentChar(line[end])) ++end;
+    const std::string_view word = line.substr(i, end - i);
+
+    static const struct {
+        std::string_view word;
+        CondKind kind;
+    } kWords[] = {
+        {"if", CondKind::If},         {"ifdef", CondKind::Ifdef}, {"ifndef", CondKind::Ifndef},
+        {"elif", CondKind::Elif},     {"else", CondKind::Else},   {"endif", CondKind::Endif},
+        {"define", CondKind::Define}, {"undef", CondKind::Undef},
+    };
+    for (const auto& w : kWords) {
+        if (word != w.word) continue;
+        d.kind = w.kind;
+        d.text = line;
+        d.rest = line.substr(end);
+        return true;
+    }
+    return false;
+}
+
+// Значение условия: "не знаю" раскрывается как истина, но #else не закрывает
+enum class Truth { False, True, Unknown };
+
+struct Macro {
+    std::string body;
+    bool function_like = false;
+};
+
+class MacroTable {
+public:
+    // "-D" без префикса: "ИМЯ" (значит 1) или "ИМЯ=значение"
+    void DefineFromArg(std::string_view arg) {
+        const std::size_t eq = arg.find('=');
+        if (eq == std::string_view::npos) {
+            macros_[std::string(arg)] = Macro{"1", false};
+        } else {
+            macros_[std::string(arg.substr(0, eq))] = Macro{std::string(arg.substr(eq + 1)), false};
+        }
+    }
+
+    // rest — то, что после "#define": " ИМЯ тело" или " ИМЯ(a, b) тело"
+    void Define(std::string_view rest) {
+        const std::size_t i = common::detail::SkipSpaces(rest, 0);
+        std::size_t end = i;
+        while (end < rest.size() && detail::IsIdentChar(rest[end])) ++end;
+        if (end == i) return;
+        Macro macro;
+        std::size_t body = end;
+        if (end < rest.size() && rest[end] == '(') {
+            macro.function_like = true;
+            body = rest.find(')', end);
+            body = body == std::string_view::npos ? rest.size() : body + 1;
+        }
+        macro.body = std::string(rest.substr(body));
+        std::string name(rest.substr(i, end - i));
+        maybe_.erase(name);
+        macros_[std::move(name)] = std::move(macro);
+    }
+
+    void Undef(std::string_view rest) {
+        const std::string name = FirstIdent(rest);
+        maybe_.erase(name);
+        macros_.erase(name);
+    }
+
+    // #define/#undef в ветке, которая может и не сработать: определено ли
+    // имя и чему равно — дальше "не знаю"
+    void MarkUncertain(std::string_view rest) {
+        std::string name = FirstIdent(rest);
+        if (!name.empty()) maybe_.insert(std::move(name));
+    }
+
+    bool IsUncertain(std::string_view name) const {
+        return !maybe_.empty() && maybe_.count(std::string(name)) > 0;
+    }
+
+    const Macro* Find(std::string_view name) const {
+        auto it = macros_.find(std::string(name));
+        return it == macros_.end() ? nullptr : &it->second;
+    }
+
+    // Не определено, но имя из тех, что определяет сам компилятор, — "не знаю"
+    Truth IsDefined(std::string_view name) const {
+        if (IsUncertain(name)) return Truth::Unknown;
+        if (Find(name)) return Truth::True;
+        return IsCompilerName(name) ? Truth::Unknown : Truth::False;
+    }
+
+    static bool IsCompilerName(std::string_view name) { return name.size() > 2 && name[0] == '_' && name[1] == '_'; }
+
+    static std::string FirstIdent(std::string_view rest) {
+        std::size_t i = common::detail::SkipSpaces(rest, 0);
+        std::size_t end = i;
+        while (end < rest.size() && detail::IsIdentChar(rest[end])) ++end;
+        return std::string(rest.substr(i, end - i));
+    }
+
+private:
+    std::unordered_map<std::string, Macro> macros_;
+    std::unordered_set<std::string> maybe_;  // определены или нет — не знаем
+};
+
+namespace detail {
+
+// Целочисленное константное выражение #if: литералы, defined, макросы,
+// ! ~ - + * / % << >> < > <= >= == != & ^ | && || ?: и скобки.
+// Как у компилятора: intmax_t / uintmax_t (64 бита), литерал с u или не
+// влезающий в intmax_t — беззнаковый, смешанные операнды приводятся к беззнаковому.
+class CondExpression {
+public:
+    explicit CondExpression(const MacroTable& macros) : macros_(macros) {}
+
+    Truth Evaluate(std::string_view expr) {
+        tokens_.clear();
+        pos_ = 0;
+        std::vector<std::string_view> expanding;
+        if (!Lex(expr, 0, expanding)) return Truth::Unknown;
+        const Value v = Ternary();
+        if (failed_ || Peek().kind != Token::End) return Truth::Unknown;
+        if (!v.known) return Truth::Unknown;
+        return v.value != 0 ? Truth::True : Truth::False;
+    }
+
+private:
+    struct Token {
+        enum Kind { End, Number, Unknown, Punct } kind = End;
+        std::int64_t value = 0;
+        bool is_unsigned = false;
+        std::string_view punct;
+    };
+
+    struct Value {
+        std::int64_t value = 0;
+        bool known = true;
+        bool is_unsigned = false;
+    };
+
+    static constexpr int kMaxExpansion = 64;
+
+    // Разбивает text на токены, подставляя макросы (рекурсивно, без самоподстановки)
+    bool Lex(std::string_view text, int depth, std::vector<std::string_view>& expanding) {
+        if (depth > kMaxExpansion) return false;
+        std::size_t i = 0;
+        while (i < text.size()) {
+            const char c = text[i];
+            if (common::IsDirectiveSpace(c) || c == '\\') {
+                ++i;
+                continue;
+            }
+            if (text.compare(i, 2, "//") == 0) break;
+            if (text.compare(i, 2, "/*") == 0) {
+                const std::size_t close = text.find("*/", i + 2);
+                if (close == std::string_view::npos) break;
+                i = close + 2;
+                continue;
+            }
+            if (c >= '0' && c <= '9') {
+                std::size_t end = i;
+                while (end < text.size() && (IsIdentChar(text[end]) || text[end] == '.')) ++end;
+                Token t;
+                if (!ParseNumber(text.substr(i, end - i), t.value, t.is_unsigned)) return false;
+                t.kind = Token::Number;
+                tokens_.push_back(t);
+                i = end;
+                continue;
+            }
+            if (c == '\'') {
+                // 'x'; escape-последовательности и прочее — "не знаю"
+                Token t;
+                t.kind = Token::Unknown;
+                if (i + 2 < text.size() && text[i + 1] != '\\' && text[i + 2] == '\'') {
+                    t.kind = Token::Number;
+                    t.value = static_cast<unsigned char>(text[i + 1]);
+                    i += 3;
+                } else {
+                    const std::size_t close = text.find('\'', i + 2);
+                    if (close == std::string_view::npos) return false;
+                    i = close + 1;
+                }
+                tokens_.push_back(t);
+                continue;
+            }
+            if (IsIdentStart(c)) {
+                std::size_t end = i;
+                while (end < text.size() && IsIdentChar(text[end])) ++end;
+                const std::string_view name = text.substr(i, end - i);
+                i = end;
+                if (name == "defined") {
+                    i = SkipSpaces(text, i);
+                    const bool paren = i < text.size() && text[i] == '(';
+                    if (paren) i = SkipSpaces(text, i + 1);
+                    std::size_t name_end = i;
+                    while (name_end < text.size() && IsIdentChar(text[name_end])) ++name_end;
+                    if (name_end == i) return false;
+                    const Truth defined = macros_.IsDefined(text.substr(i, name_end - i));
+                    i = name_end;
+                    if (paren) {
+                        i = SkipSpaces(text, i);
+                        if (i == text.size() || text[i] != ')') return false;
+                        ++i;
+                    }
+                    PushTruth(defined);
+                    continue;
+                }
+                if (!Identifier(name, text, i, depth, expanding)) return false;
+                continue;
+            }
+            static const std::string_view kPuncts[] = {"<<", ">>", "<=", ">=", "==", "!=", "&&", "||",
+                                                       "(", ")", "!", "~", "-", "+", "*", "/", "%",
+                                                       "<", ">", "&", "^", "|", "?", ":"};
+            bool matched = false;
+            for (std::string_view p : kPuncts) {
+                if (text.compare(i, p.size(), p) != 0) continue;
+                Token t;
+                t.kind = Token::Punct;
+                t.punct = p;
+                tokens_.push_back(t);
+                i += p.size();
+                matched = true;
+                break;
+            }
+            if (!matched) return false;
+        }
+        return true;
+    }
+
+    static std::size_t SkipSpaces(std::string_view text, std::size_t i) {
+        while (i < text.size() && (common::IsDirectiveSpace(text[i]) || text[i] == '\\')) ++i;
+        return i;
+    }
+
+    // Имя в выражении: макрос подставляется, true/false — 1/0, прочие — 0
+    // (как у компилятора), имена компилятора и вызовы function-like — "не знаю"
+    bool Identifier(std::string_view name, std::string_view text, std::size_t& i, int depth,
+                    std::vector<std::string_view>& expanding) {
+        for (std::string_view active : expanding) {
+            if (active == name) {
+                PushTruth(Truth::False);  // самоподстановки нет: имя остаётся и значит 0
+                return true;
+            }
+        }
+        if (macros_.IsUncertain(name)) {
+            PushTruth(Truth::Unknown);
+            return true;
+        }
+        const Macro* macro = macros_.Find(name);
+        if (!macro) {
+            if (name == "true" || name == "false") PushTruth(name == "true" ? Truth::True : Truth::False);
+            else PushTruth(MacroTable::IsCompilerName(name) ? Truth::Unknown : Truth::False);
+            return true;
+        }
+        if (macro->function_like) {
+            // вызов пропускаем целиком, значение неизвестно
+            std::size_t j = SkipSpaces(text, i);
+            if (j < text.size() && text[j] == '(') {
+                int level = 0;
+                for (; j < text.size(); ++j) {
+                    if (text[j] == '(') ++level;
+                    if (text[j] == ')' && --level == 0) break;
+                }
+                if (j == text.size()) return false;
+                i = j + 1;
+            }
+            PushTruth(Truth::Unknown);
+            return true;
+        }
+        expanding.push_back(name);
+        const bool ok = Lex(macro->body, depth + 1, expanding);
+        expanding.pop_back();
+        return ok;
+    }
+
+    void PushTruth(Truth t) {
+        Token token;
+        token.kind = t == Truth::Unknown ? Token::Unknown : Token::Number;
+        token.value = t == Truth::True ? 1 : 0;
+        tokens_.push_back(token);
+    }
+
+    // false — не число или не влезает в 64 бита
+    static bool ParseNumber(std::string_view s, std::int64_t& value, bool& is_unsigned) {
+        is_unsigned = false;
+        while (!s.empty() && (s.back() == 'u' || s.back() == 'U' || s.back() == 'l' || s.back() == 'L')) {
+            is_unsigned = is_unsigned || s.back() == 'u' || s.back() == 'U';
+            s.remove_suffix(1);
+        }
+        int base = 10;
+        std::size_t i = 0;
+        if (s.size() > 1 && s[0] == '0') {
+            if (s[1] == 'x' || s[1] == 'X') {
+                base = 16;
+                i = 2;
+            } else if (s[1] == 'b' || s[1] == 'B') {
+                base = 2;
+                i = 2;
+            } else {
+                base = 8;
+                i = 1;
+            }
+        }
+        if (i == s.size() && base != 8) return false;
+        std::uint64_t v = 0;
+        for (; i < s.size(); ++i) {
+            const char c = s[i];
+            int digit = -1;
+            if (c >= '0' && c <= '9') digit = c - '0';
+            else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+            if (digit < 0 || digit >= base) return false;  // в том числе 1.5 и 1e3
+            const auto b = static_cast<std::uint64_t>(base), d = static_cast<std::uint64_t>(digit);
+            if (v > (UINT64_MAX - d) / b) return false;
+            v = v * b + d;
+        }
+        // не влезает в intmax_t — uintmax_t (десятичный так же понимает GCC, с предупреждением)
+        if (v > static_cast<std::uint64_t>(INT64_MAX)) is_unsigned = true;
+        value = static_cast<std::int64_t>(v);
+        return true;
+    }
+
+    const Token& Peek() const {
+        static const Token kEnd;
+        return pos_ < tokens_.size() ? tokens_[pos_] : kEnd;
+    }
+
+    bool Accept(std::string_view punct) {
+        const Token& t = Peek();
+        if (t.kind != Token::Punct || t.punct != punct) return false;
+        ++pos_;
+        return true;
+    }
+
+    Value Ternary() {
+        const Value cond = Binary(1);
+        if (!Accept("?")) return cond;
+        const Value a = Ternary();
+        if (!Accept(":")) {
+            failed_ = true;
+            return {};
+        }
+        const Value b = Ternary();
+        const bool is_unsigned = a.is_unsigned || b.is_unsigned;  // тип ?: — общий для обеих ветвей
+        if (!cond.known) {
+            if (a.known && b.known && a.value == b.value) return {a.value, true, is_unsigned};
+            return {0, false};
+        }
+        Value v = cond.value != 0 ? a : b;
+        v.is_unsigned = is_unsigned;
+        return v;
+    }
+
+    static int Precedence(std::string_view op) {
+        if (op == "||") return 1;
+        if (op == "&&") return 2;
+        if (op == "|") return 3;
+        if (op == "^") return 4;
+        if (op == "&") return 5;
+        if (op == "==" || op == "!=") return 6;
+        if (op == "<" || op == ">" || op == "<=" || op == ">=") return 7;
+        if (op == "<<" || op == ">>") return 8;
+        if (op == "+" || op == "-") return 9;
+        if (op == "*" || op == "/" || op == "%") return 10;
+        return 0;
+    }
+
+    Value Binary(int min_prec) {
+        Value left = Unary();
+        for (;;) {
+            const Token& t = Peek();
+            if (t.kind != Token::Punct) return left;
+            const std::string_view op = t.punct;
+            const int prec = Precedence(op);
+            if (prec == 0 || prec < min_prec) return left;
+            ++pos_;
+            const Value right = Binary(prec + 1);
+            left = Apply(op, left, right);
+        }
+    }
+
+    Value Apply(std::string_view op, Value a, Value b) {
+        // && и || знают ответ и при одной неизвестной стороне
+        if (op == "&&") {
+            if ((a.known && a.value == 0) || (b.known && b.value == 0)) return {0, true};
+            if (!a.known || !b.known) return {0, false};
+            return {1, true};
+        }
+        if (op == "||") {
+            if ((a.known && a.value != 0) || (b.known && b.value != 0)) return {1, true};
+            if (!a.known || !b.known) return {0, false};
+            return {0, true};
+        }
+        if (!a.known || !b.known) return {0, false};
+        const std::int64_t x = a.value, y = b.value;
+        const auto ux = static_cast<std::uint64_t>(x), uy = static_cast<std::uint64_t>(y);
+        // обычные арифметические преобразования: один беззнаковый — оба беззнаковые
+        const bool u = a.is_unsigned || b.is_unsigned;
+        const auto wrap = [u](std::uint64_t r) { return Value{static_cast<std::int64_t>(r), true, u}; };
+        if (op == "|") return wrap(ux | uy);
+        if (op == "^") return wrap(ux ^ uy);
+        if (op == "&") return wrap(ux & uy);
+        if (op == "==") return {x == y, true};
+        if (op == "!=") return {x != y, true};
+        if (op == "<") return {u ? ux < uy : x < y, true};
+        if (op == ">") return {u ? ux > uy : x > y, true};
+        if (op == "<=") return {u ? ux <= uy : x <= y, true};
+        if (op == ">=") return {u ? ux >= uy : x >= y, true};
+        if (op == "<<" || op == ">>") {
+            // тип сдвига — тип левого операнда
+            if (b.is_unsigned ? uy > 63 : (y < 0 || y > 63)) return {0, false};
+            if (op == "<<") return {static_cast<std::int64_t>(ux << y), true, a.is_unsigned};
+            return {a.is_unsigned ? static_cast<std::int64_t>(ux >> y) : x >> y, true, a.is_unsigned};
+        }
+        if (op == "+") return wrap(ux + uy);
+        if (op == "-") return wrap(ux - uy);
+        if (op == "*") return wrap(ux * uy);
+        if (y == 0) return {0, false};  // компилятор тут выдаст ошибку — не нам решать
+        if (u) return wrap(op == "/" ? ux / uy : ux % uy);
+        if (x == INT64_MIN && y == -1) return {0, false};  // переполнение, как и деление на 0
+        if (op == "/") return {x / y, true};
+        return {x % y, true};
+    }
+
+    Value Unary() {
+        if (Accept("!")) {
+            const Value v = Unary();
+            return {v.value == 0, v.known};
+        }
+        if (Accept("~")) {
+            const Value v = Unary();
+            return {~v.value, v.known, v.is_unsigned};
+        }
+        if (Accept("-")) {
+            const Value v = Unary();
+            return {static_cast<std::int64_t>(0 - static_cast<std::uint64_t>(v.value)), v.known, v.is_unsigned};
+        }
+        if (Accept("+")) return Unary();
+        if (Accept("(")) {
+            const Value v = Ternary();
+            if (!Accept(")")) failed_ = true;
+            return v;
+        }
+        const Token& t = Peek();
+        if (t.kind == Token::Number || t.kind == Token::Unknown) {
+            ++pos_;
+            return {t.value, t.kind == Token::Number, t.is_unsigned};
+        }
+        failed_ = true;
+        return {0, false};
+    }
+
+    const MacroTable& macros_;
+    std::vector<Token> tokens_;
+    std::size_t pos_ = 0;
+    bool failed_ = false;
+};
+
+} // namespace detail
+
+inline Truth EvaluateCondition(std::string_view expr, const MacroTable& macros) {
+    return detail::CondExpression(macros).Evaluate(expr);
+}
+
+// Стек открытых #if и таблица макросов одного прогона
+class Conditions {
+public:
+    explicit Conditions(const std::vector<std::string>& defines) {
+        for (const std::string& d : defines) macros_.DefineFromArg(d);
+    }
+
+    // Можно ли раскрывать include здесь: false — ветка точно неактивна
+    bool Active() const { return branches_.empty() || branches_.back().active; }
+
+    // Ветка точно активна: она и все объемлющие взяты наверняка
+    bool Certain() const { return branches_.empty() || branches_.back().certain; }
+
+    void Apply(const CondDirective& d) {
+        switch (d.kind) {
+            case CondKind::If:
+            case CondKind::Ifdef:
+            case CondKind::Ifndef: {
+                const bool parent = Active();
+                const Truth t = parent ? Test(d) : Truth::False;
+                branches_.push_back({parent, Certain(), t != Truth::False, t == Truth::True,
+                                     Certain() && t == Truth::True, t == Truth::Unknown});
+                break;
+            }
+            case CondKind::Elif: {
+                if (branches_.empty()) break;
+                Branch& b = branches_.back();
+                if (!b.parent_active || b.taken) {
+                    b.active = false;
+                    b.certain = false;
+                } else {
+                    const Truth t = Test(d);
+                    b.active = t != Truth::False;
+                    b.taken = t == Truth::True;
+                    // до неё была ветка "не знаю" — могла быть взята она
+                    b.certain = b.parent_certain && t == Truth::True && !b.maybe_taken;
+                    b.maybe_taken = b.maybe_taken || t == Truth::Unknown;
+                }
+                break;
+            }
+            case CondKind::Else: {
+                if (branches_.empty()) break;
+                Branch& b = branches_.back();
+                b.active = b.parent_active && !b.taken;
+                b.certain = b.parent_certain && !b.taken && !b.maybe_taken;
+                b.taken = true;
+                break;
+            }
+            case CondKind::Endif:
+                if (!branches_.empty()) branches_.pop_back();
+                break;
+            case CondKind::Define:
+                if (Certain()) macros_.Define(d.rest);
+                else if (Active()) macros_.MarkUncertain(d.rest);
+                break;
+            case CondKind::Undef:
+                if (Certain()) macros_.Undef(d.rest);
+                else if (Active()) macros_.MarkUncertain(d.rest);
+                break;
+        }
+    }
+
+    // Файл кончился: его незакрытые #if закрываем (компилятор тут выдал бы ошибку)
+    std::size_t Depth() const { return branches_.size(); }
+    void Truncate(std::size_t depth) {
+        if (branches_.size() > depth) branches_.resize(depth);
+    }
+
+    const MacroTable& Macros() const { return macros_; }
+
+private:
+    struct Branch {
+        bool parent_active = true;
+        bool parent_certain = true;
+        bool active = true;        // ветка может быть активной
+        bool taken = false;        // какая-то ветка этого #if точно взята
+        bool certain = true;       // текущая ветка точно взята (и объемлющие тоже)
+        bool maybe_taken = false;  // была ветка "не знаю" — могла быть взята она
+    };
+
+    Truth Test(const CondDirective& d) const {
+        if (d.kind == CondKind::If || d.kind == CondKind::Elif) return EvaluateCondition(d.rest, macros_);
+        const Truth defined = macros_.IsDefined(MacroTable::FirstIdent(d.rest));
+        if (d.kind == CondKind::Ifdef || defined == Truth::Unknown) return defined;
+        return defined == Truth::True ? Truth::False : Truth::True;
+    }
+
+    MacroTable macros_;
+    std::vector<Branch> branches_;
+};
+
+} // namespace v2
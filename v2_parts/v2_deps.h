@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "v2_preprocess_impl.h"
+#include "v2_stats.h"
+
+namespace v2 {
+namespace fs = std::filesystem;
+
+// =======================
+// --deps: только граф include, без вывода раскрытого текста
+// =======================
+//
+// Каждый файл разбирается FileCache (сегменты — string_view в буфер, тела
+// не копируются), include ищет тот же IncludeResolver. Граф обходится в
+// глубину в порядке раскрытия, каждый файл — один раз.
+
+struct IncludeEdge {
+    std::size_t from = 0;  // индекс в IncludeGraph::files
+    std::size_t to = 0;
+    std::size_t line_no = 0;
+    bool angle = false;
+    std::string token;
+};
+
+struct IncludeGraph {
+    std::vector<fs::path> files;  // [0] — входной файл, дальше в порядке первого появления
+    std::vector<IncludeEdge> edges;
+};
+
+// false — входной файл не открылся или include не найден (сообщение как в ТЗ-режиме
+// пишется в log, граф содержит всё, что успели найти до ошибки).
+inline bool ScanIncludeGraph(const fs::path& in_file,
+                             Mode mode,
+                             SharedCaches& caches,
+                             IncludeGraph& graph,
+                             RunStats& stats,
+                             std::ostream& log) {
+    std::unordered_map<std::string, std::size_t> index;
+    auto node = [&](const fs::path& file, bool& is_new) {
+        auto [it, inserted] = index.emplace(file.string(), graph.files.size());
+        is_new = inserted;
+        if (inserted) graph.files.push_back(file);
+        return it->second;
+    };
+
+    bool is_new = false;
+    node(in_file, is_new);
+
+    struct Frame {
+        const ParsedFile* file;
+        std::size_t id;
+        std::size_t next = 0;  // следующий сегмент
+    };
+    std::vector<Frame> stack;
+
+    const ParsedFile* root = caches.files.Load(in_file, &stats.files);
+    if (!root) return false;
+    stack.push_back({root, 0});
+
+    while (!stack.empty()) {
+        Frame& top = stack.back();
+        if (top.next == top.file->segments.size()) {
+            stack.pop_back();
+            continue;
+        }
+        const Segment& seg = top.file->segments[top.next++];
+        const bool quoted = seg.kind == SegmentKind::IncludeQuote;
+        const bool angle = seg.kind == SegmentKind::IncludeAngle;
+        if (!quoted && !(angle && mode == Mode::TZ)) continue;
+
+        const fs::path& current = graph.files[top.id];
+        const fs::path* target = caches.resolver.Resolve(current.parent_path(), seg.token, quoted, &stats.resolver);
+        if (!target) {
+            if (mode == Mode::TZ) {
+                log << "unknown include file " << seg.token
+                    << " at file " << current.string()
+                    << " at line " << seg.line_no << "\n";
+            }
+            return false;
+        }
+
+        const std::size_t from = top.id;
+        const std::size_t to = node(*target, is_new);
+        graph.edges.push_back({from, to, seg.line_no, angle, std::string(seg.token)});
+        if (!is_new) continue;
+
+        const ParsedFile* child = caches.files.Load(*target, &stats.files);
+        if (!child) return false;
+        stack.push_back({child, to});  // top после push_back недействителен — дальше не трогаем
+    }
+    return true;
+}
+
+namespace detail {
+
+// Пробелы и '#' в путях make-файла экранируются, '$' удваивается
+inline std::string MakeEscape(const std::string& s) {
+    std::string out;
+    for (char c : s) {
+        if (c == ' ' || c == '#') out += '\\';
+        if (c == '$') out += '$';
+        out += c;
+    }
+    return out;
+}
+
+} // namespace detail
+
+// Depfile как у gcc -MD -MP: "target: deps..." плюс пустые правила для заголовков,
+// чтобы удалённый заголовок не ломал make.
+inline void WriteDepfile(std::ostream& out, const std::string& target, const IncludeGraph& graph) {
+    out << detail::MakeEscape(target) << ":";
+    for (const auto& file : graph.files) out << " \\\n  " << detail::MakeEscape(file.generic_string());
+    out << "\n";
+    for (std::size_t i = 1; i < graph.files.size(); ++i) {
+        out << "\n" << detail::MakeEscape(graph.files[i].generic_string()) << ":\n";
+    }
+}
+
+inline void WriteGraphJson(std::ostream& out, const IncludeGraph& graph) {
+    out << "{\n  \"files\": [";
+    for (std::size_t i = 0; i < graph.files.size(); ++i) {
+        out << (i ? ", " : "") << "\"" << detail::JsonEscape(graph.files[i].generic_string()) << "\"";
+    }
+    out << "],\n  \"edges\": [";
+    for (std::size_t i = 0; i < graph.edges.size(); ++i) {
+        const IncludeEdge& e = graph.edges[i];
+        out << (i ? "," : "") << "\n    {\"from\": " << e.from << ", \"to\": " << e.to
+            << ", \"line\": " << e.line_no << ", \"kind\": \"" << (e.angle ? "angle" : "quote")
+            << "\", \"token\": \"" << detail::JsonEscape(e.token) << "\"}";
+    }
+    out << (graph.edges.empty() ? "" : "\n  ") << "]\n}\n";
+}
+
+inline void WriteGraphDot(std::ostream& out, const IncludeGraph& graph) {
+    out << "digraph includes {\n";
+    for (const IncludeEdge& e : graph.edges) {
+        out << "  \"" << detail::JsonEscape(graph.files[e.from].generic_string()) << "\" -> \""
+            << detail::JsonEscape(graph.files[e.to].generic_string()) << "\" [label=\"" << e.line_no << "\"];\n";
+    }
+    out << "}\n";
+}
+
+} // namespace v2
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "../common/directive_scanner.h"
+#include "../common/include_once.h"
+#include "v2_conditional.h"
+#include "v2_intern.h"
+#include "v2_source.h"
+#include "v2_vfs.h"
+
+namespace v2 {
+namespace fs = std::filesystem;
+
+// =======================
+// Кэш разобранных файлов: каждый файл читается и разбирается один раз за прогон,
+// повторные include проигрывают готовый список сегментов
+// =======================
+
+enum class SegmentKind {
+    Text,          // строки без include — выводятся как есть
+    IncludeQuote,  // #include "..."
+    IncludeAngle,  // #include <...>
+    PragmaOnce,    // #pragma once (flatten его выбрасывает, ТЗ-режим выводит как текст)
+};
+
+struct Segment {
+    SegmentKind kind = SegmentKind::Text;
+    std::string_view text;    // Text: готовые строки; Include*: сама строка-директива
+    std::string_view token;   // Include*: имя файла между "" или <>
+    std::size_t line_no = 0;  // Include*: номер строки (для "unknown include file")
+};
+
+// Файл после разбора. Сегменты смотрят либо в отображение source,
+// либо (если в файле были '\r' или он в UTF-16) в нормализованную копию normalized.
+struct ParsedFile {
+    SourceBuffer source;
+    std::string normalized;
+    std::vector<Segment> segments;
+    std::vector<CondDirective> conditionals;  // #if/#define/... по порядку (текст — в сегментах)
+    std::string identity;       // канонический путь: один файл — один ключ
+    bool include_once = false;  // #pragma once или include guard
+    FileStamp stamp;            // версия файла до чтения (для Revalidate)
+
+    // для --stats: во что обошёлся разбор (один раз на файл, не на include)
+    std::size_t lines = 0;       // строк просмотрено
+    std::size_t directives = 0;  // из них распознано директив (include / pragma once)
+    std::uint64_t read_ns = 0;   // открыть и прочитать/отобразить
+    std::uint64_t scan_ns = 0;   // нормализация и поиск директив
+};
+
+// Разбор текста (BOM уже снят, '\r' в концах строк уже убраны) на сегменты;
+// директивы условной компиляции — отдельно в conditionals. Возвращает число строк.
+inline std::size_t ParseSegments(std::string_view text, std::vector<Segment>& segments,
+                                 std::vector<CondDirective>& conditionals) {
+    const char* p = text.data();
+    const char* const end = p + text.size();
+    const char* text_begin = p;
+    std::size_t line_no = 0;
+
+    auto flush_text = [&](const char* upto) {
+        if (upto > text_begin) {
+            segments.push_back({SegmentKind::Text, {text_begin, static_cast<std::size_t>(upto - text_begin)}, {}, 0});
+        }
+    };
+
+    while (p < end) {
+        const char* d = common::FindDirectiveLine(p, end);
+        line_no += common::CountLines(p, d);
+        if (d == end) break;
+
+        const char* eol = common::FindLineEnd(d, end);
+        ++line_no;
+        p = eol == end ? end : eol + 1;
+
+        const common::Directive directive = common::ParseDirectiveLine({d, static_cast<std::size_t>(eol - d)});
+        SegmentKind kind;
+        switch (directive.kind) {
+            case common::DirectiveKind::IncludeQuote: kind = SegmentKind::IncludeQuote; break;
+            case common::DirectiveKind::IncludeAngle: kind = SegmentKind::IncludeAngle; break;
+            case common::DirectiveKind::PragmaOnce: kind = SegmentKind::PragmaOnce; break;
+            default: {
+                // прочие '#'-строки остаются внутри текущего текстового сегмента;
+                // условную компиляцию запоминаем вместе со строками-продолжениями
+                // (сами продолжения сканируются дальше как обычно)
+                CondDirective cond;
+                if (ParseCondDirective({d, static_cast<std::size_t>(eol - d)}, cond)) {
+                    const char* last = eol;
+                    while (last != end && last[-1] == '\\') last = common::FindLineEnd(last + 1, end);
+                    if (last != eol) ParseCondDirective({d, static_cast<std::size_t>(last - d)}, cond);
+                    conditionals.push_back(cond);
+                }
+                continue;
+            }
+        }
+
+        flush_text(d);
+        segments.push_back({kind, {d, static_cast<std::size_t>(p - d)}, directive.token, line_no});
+        text_begin = p;
+    }
+
+    flush_text(end);
+    return line_no;
+}
+
+struct FileCacheStats {
+    std::size_t files_read = 0;      // файлов прочитано с диска и разобрано
+    std::size_t files_replayed = 0;  // повторных загрузок, обслуженных из кэша
+
+    // по прочитанным с диска файлам
+    std::uint64_t bytes_read = 0;
+    std::size_t lines_scanned = 0;
+    std::size_t directives_matched = 0;
+    std::uint64_t read_ns = 0;
+    std::uint64_t scan_ns = 0;
+};
+
+inline FileCacheStats& operator+=(FileCacheStats& to, const FileCacheStats& d) {
+    to.files_read += d.files_read;
+    to.files_replayed += d.files_replayed;
+    to.bytes_read += d.bytes_read;
+    to.lines_scanned += d.lines_scanned;
+    to.directives_matched += d.directives_matched;
+    to.read_ns += d.read_ns;
+    to.scan_ns += d.scan_ns;
+    return to;
+}
+
+// Потокобезопасен: один кэш можно делить между потоками (batch-режим).
+// Пока один поток разбирает файл, остальные, кому он нужен, ждут его.
+class FileCache {
+public:
+    explicit FileCache(FileProvider& files = DiskFiles()) : provider_(files) {}
+
+    // nullptr — файл не открылся. run_stats (если задан) — счётчики конкретного прогона,
+    // Stats() — итог по всем прогонам.
+    const ParsedFile* Load(const fs::path& file, FileCacheStats* run_stats = nullptr) {
+        std::string buf;
+        const std::string& key = PathString(file, buf);
+        std::shared_ptr<Entry> entry;
+        {
+            std::lock_guard lock(mutex_);
+            auto it = files_.find(key);  // повторная загрузка — без выделения памяти под ключ
+            if (it == files_.end()) it = files_.emplace(key, std::make_shared<Entry>()).first;
+            entry = it->second;
+        }
+
+        bool parsed_here = false;
+        std::call_once(entry->once, [&] {
+            entry->file = Parse(file);
+            parsed_here = true;
+        });
+
+        if (!entry->file) {
+            // не кэшируем неудачу: файл может появиться позже
+            std::lock_guard lock(mutex_);
+            if (auto it = files_.find(key); it != files_.end() && it->second == entry) {
+                files_.erase(it);
+            }
+            return nullptr;
+        }
+
+        Count(parsed_here ? entry->file.get() : nullptr, run_stats);
+        return entry->file.get();
+    }
+
+    // Для долгоживущего процесса: выбрасывает файлы, чей размер или mtime
+    // изменился, — следующий Load прочитает их заново. Вызывать между прогонами:
+    // указатели на выброшенные файлы становятся недействительными.
+    // Возвращает, сколько файлов выброшено.
+    std::size_t Revalidate() {
+        std::lock_guard lock(mutex_);
+        std::size_t dropped = 0;
+        for (auto it = files_.begin(); it != files_.end();) {
+            const ParsedFile* file = it->second->file.get();
+            if (file && provider_.Stamp(fs::path(it->first)) == file->stamp) {
+                ++it;
+                continue;
+            }
+            it = files_.erase(it);
+            ++dropped;
+        }
+        return dropped;
+    }
+
+    // Выбрасывает один файл (путь — как в Load), не сверяясь с диском: для
+    // --watch, где об изменении сообщила ОС. Как и Revalidate — между прогонами.
+    // true — файл был в кэше.
+    bool Forget(const fs::path& file) {
+        std::string buf;
+        const std::string& key = PathString(file, buf);
+        std::lock_guard lock(mutex_);
+        return files_.erase(key) > 0;
+    }
+
+    // Пути всех файлов в кэше — как их передавали в Load
+    std::vector<fs::path> Paths() const {
+        std::lock_guard lock(mutex_);
+        std::vector<fs::path> paths;
+        paths.reserve(files_.size());
+        for (const auto& entry : files_) paths.emplace_back(entry.first);
+        return paths;
+    }
+
+    FileCacheStats Stats() const {
+        std::lock_guard lock(mutex_);
+        return stats_;
+    }
+
+private:
+    struct Entry {
+        std::once_flag once;
+        std::unique_ptr<ParsedFile> file;
+    };
+
+    std::unique_ptr<ParsedFile> Parse(const fs::path& file) {
+        using Clock = std::chrono::steady_clock;
+        const auto t0 = Clock::now();
+
+        // ParsedFile создаём сразу в куче: сегменты ссылаются на его буферы
+        auto parsed = std::make_unique<ParsedFile>();
+        parsed->stamp = provider_.Stamp(file);  // до чтения: правка во время чтения даст новую версию
+        if (!provider_.Open(file, parsed->source)) return nullptr;
+        const auto t1 = Clock::now();
+
+        const std::string_view text = NormalizeText(parsed->source.View(), parsed->normalized);
+        parsed->lines = ParseSegments(text, parsed->segments, parsed->conditionals);
+        parsed->identity = provider_.Identity(file);
+        for (const Segment& seg : parsed->segments) {
+            if (seg.kind == SegmentKind::Text) continue;
+            ++parsed->directives;
+            if (seg.kind == SegmentKind::PragmaOnce) parsed->include_once = true;
+        }
+        if (!parsed->include_once) parsed->include_once = common::HasIncludeGuard(text);
+
+        const auto t2 = Clock::now();
+        parsed->read_ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+        parsed->scan_ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count());
+        return parsed;
+    }
+
+    // read — файл прочитан этим вызовом (тогда и его стоимость идёт в счётчики)
+    void Count(const ParsedFile* read, FileCacheStats* run_stats) {
+        FileCacheStats delta;
+        if (read) {
+            delta.files_read = 1;
+            delta.bytes_read = read->source.View().size();
+            delta.lines_scanned = read->lines;
+            delta.directives_matched = read->directives;
+            delta.read_ns = read->read_ns;
+            delta.scan_ns = read->scan_ns;
+        } else {
+            delta.files_replayed = 1;
+        }
+        if (run_stats) *run_stats += delta;
+        std::lock_guard lock(mutex_);
+        stats_ += delta;
+    }
+
+    FileProvider& provider_;
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<Entry>> files_;
+    FileCacheStats stats_;
+};
+
+} // namespace v2
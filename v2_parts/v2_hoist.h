@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include "../common/changed_file.h"
+#include "v2_conditional.h"
+#include "v2_file_cache.h"
+#include "v2_output.h"
+
+namespace v2 {
+namespace fs = std::filesystem;
+
+// =======================
+// --hoist-system: #include <...> при flatten — один раз, в начале вывода
+// =======================
+//
+// Поднимаются только include, которые компилятор видит при любых макросах:
+// вне #if/#ifdef/... (include guard самого файла не в счёт) в файле, который
+// и сам подключён вне #if. Остальные остаются на месте. Порядок — порядок
+// первой встречи, повторы убираются.
+// Цена: системный заголовок оказывается раньше пользовательских #define
+// (_GNU_SOURCE, NOMINMAX, ...) — такие макросы надо задавать через -D.
+
+class SystemIncludes {
+public:
+    // line — строка-директива как в файле; должна жить, пока нужен пролог.
+    // false — такой заголовок уже есть.
+    bool Add(std::string_view token, std::string_view line) {
+        if (!seen_.insert(std::string(token)).second) return false;
+        lines_.push_back(line);
+        return true;
+    }
+
+    const std::vector<std::string_view>& Lines() const { return lines_; }
+
+    void WriteTo(OutputSink& out) const {
+        for (std::string_view line : lines_) out.WriteText(line);
+    }
+
+    // Отдельный заголовок (для предкомпиляции: g++ -x c++-header). Без #pragma once:
+    // его подключают один раз, а g++ на нём предупреждает при сборке .gch.
+    // Файл не переписывается, если в нём уже то же самое: иначе .gch пришлось бы пересобирать.
+    bool WriteHeader(const fs::path& path) const {
+        common::ChangedFile out(path);
+        for (std::string_view line : lines_) {
+            out.write(line.data(), static_cast<std::streamsize>(line.size()));
+            if (line.empty() || line.back() != '\n') out.put('\n');
+        }
+        return out.Commit();
+    }
+
+private:
+    std::unordered_set<std::string> seen_;
+    std::vector<std::string_view> lines_;
+};
+
+namespace detail {
+
+inline bool OpensBranch(CondKind kind) {
+    return kind == CondKind::If || kind == CondKind::Ifdef || kind == CondKind::Ifndef;
+}
+
+inline bool IsBranch(CondKind kind) {
+    return kind != CondKind::Define && kind != CondKind::Undef;
+}
+
+// Первая ветка файла — "#ifndef X / #define X", и её #endif — последняя ветка файла
+inline bool HasIncludeGuard(const ParsedFile& file) {
+    if (!file.include_once) return false;
+    const std::vector<CondDirective>& list = file.conditionals;
+    std::size_t first = 0;
+    while (first < list.size() && !IsBranch(list[first].kind)) ++first;
+    if (first + 1 >= list.size() || list[first].kind != CondKind::Ifndef) return false;
+    const CondDirective& define = list[first + 1];
+    if (define.kind != CondKind::Define ||
+        MacroTable::FirstIdent(define.rest) != MacroTable::FirstIdent(list[first].rest)) {
+        return false;
+    }
+
+    std::size_t depth = 0;
+    for (std::size_t i = first; i < list.size(); ++i) {
+        if (OpensBranch(list[i].kind)) {
+            ++depth;
+        } else if ((list[i].kind == CondKind::Else || list[i].kind == CondKind::Elif) && depth == 1) {
+            return false;  // у guard'а нет #else
+        } else if (list[i].kind == CondKind::Endif && depth > 0 && --depth == 0) {
+            for (++i; i < list.size(); ++i) {
+                if (IsBranch(list[i].kind)) return false;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// Глубина #if в файле по ходу обхода: позиции запрашиваются по возрастанию
+struct IfDepth {
+    std::size_t next = 0;   // следующая директива file.conditionals
+    std::size_t depth = 0;
+    bool guarded = false;   // внешний #ifndef — include guard, его не считаем
+
+    std::size_t At(const ParsedFile& file, const char* at) {
+        const std::vector<CondDirective>& list = file.conditionals;
+        for (; next < list.size() && list[next].text.data() < at; ++next) {
+            if (OpensBranch(list[next].kind)) ++depth;
+            else if (list[next].kind == CondKind::Endif && depth > 0) --depth;
+        }
+        return depth - (guarded && depth > 0 ? 1 : 0);
+    }
+};
+
+} // namespace detail
+
+} // namespace v2
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace v2 {
+namespace fs = std::filesystem;
+
+// =======================
+// Арена и таблица интернирования: каждая разная строка (каталог, токен
+// include, найденный путь) хранится один раз и дальше передаётся номером
+// =======================
+
+// Строки складываются в большие блоки и не освобождаются по одной — только
+// вместе с ареной. Адреса сохранённых строк не меняются.
+class Arena {
+public:
+    static constexpr std::size_t kBlockSize = 64 * 1024;
+
+    std::string_view Store(std::string_view s) {
+        if (s.size() > kBlockSize / 4) {
+            // длинная строка — отдельный блок, текущий не трогаем
+            blocks_.push_back(std::make_unique<char[]>(s.size()));
+            bytes_ += s.size();
+            std::memcpy(blocks_.back().get(), s.data(), s.size());
+            return {blocks_.back().get(), s.size()};
+        }
+        if (!head_ || used_ + s.size() > kBlockSize) {
+            blocks_.push_back(std::make_unique<char[]>(kBlockSize));
+            head_ = blocks_.back().get();
+            used_ = 0;
+            bytes_ += kBlockSize;
+        }
+        char* dst = head_ + used_;
+        if (!s.empty()) std::memcpy(dst, s.data(), s.size());
+        used_ += s.size();
+        return {dst, s.size()};
+    }
+
+    std::size_t Blocks() const { return blocks_.size(); }
+    std::size_t Bytes() const { return bytes_; }
+
+private:
+    std::vector<std::unique_ptr<char[]>> blocks_;
+    char* head_ = nullptr;  // блок, в который сейчас дописываем
+    std::size_t used_ = 0;
+    std::size_t bytes_ = 0;
+};
+
+// Строка -> номер (0, 1, 2, ...). Поиск по string_view без выделения памяти.
+// Не потокобезопасна: блокировки — забота владельца.
+class InternTable {
+public:
+    static constexpr std::uint32_t kNone = UINT32_MAX;
+
+    std::uint32_t Find(std::string_view s) const {
+        auto it = ids_.find(s);
+        return it == ids_.end() ? kNone : it->second;
+    }
+
+    std::uint32_t Intern(std::string_view s) {
+        if (auto it = ids_.find(s); it != ids_.end()) return it->second;
+        const std::string_view stored = arena_.Store(s);
+        const auto id = static_cast<std::uint32_t>(views_.size());
+        views_.push_back(stored);
+        ids_.emplace(stored, id);
+        return id;
+    }
+
+    std::string_view View(std::uint32_t id) const { return views_[id]; }
+    std::size_t Size() const { return views_.size(); }
+    const Arena& Storage() const { return arena_; }
+
+private:
+    Arena arena_;
+    std::unordered_map<std::string_view, std::uint32_t> ids_;  // ключи смотрят в arena_
+    std::vector<std::string_view> views_;
+};
+
+// Путь как строка без копирования там, где это возможно: на POSIX native() —
+// уже std::string, на Windows (wstring) приходится конвертировать в buf.
+inline const std::string& PathString(const fs::path& p, std::string& buf) {
+#if defined(_WIN32)
+    buf = p.string();
+    return buf;
+#else
+    (void)buf;
+    return p.native();
+#endif
+}
+
+} // namespace v2
@@ -1,13 +1,119 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "../common/tests_common.h"
+#include "v2_batch.h"
+#include "v2_deps.h"
 #include "v2_preprocess_impl.h"
+#include "v2_server.h"
+#include "v2_stats.h"
+#include "v2_tests.h"
+#include "v2_unity.h"
+#include "v2_watch.h"
 
 namespace fs = std::filesystem;
 
+enum class StatsFormat { None, Text, Json };
+
+// Вынимает из args флаги настроек прогона (где бы они ни стояли):
+//   -jN / --jobs=N — потоков для предзагрузки дерева include (0 — по числу ядер)
+//   --stats[=json] — отчёт о прогоне в stderr; --stats-top=N — сколько дорогих файлов в нём (10)
+//   -DИМЯ[=значение] / --conditional — учитывать #if: include в неактивных ветках не раскрывать
+//   --minify — вывод без комментариев, отступов и пустых строк
+//   --break-cycles — flatten: include, замыкающий цикл, пропустить и продолжить
+//   --hoist-system / --system-header=ИМЯ — flatten: <...> один раз в начало / в заголовок ИМЯ рядом с выводом
+// Остальное остаётся позиционными аргументами. false — неверное значение флага.
+static bool ExtractRunOptions(std::vector<std::string>& args, v2::RunOptions& options, bool& jobs_given,
+                              StatsFormat& stats) {
+    std::vector<std::string> rest;
+    std::size_t top_files = 10;
+    for (const std::string& arg : args) {
+        std::string value;
+        if (arg == "--stats" || arg == "--stats=text") {
+            stats = StatsFormat::Text;
+            continue;
+        }
+        if (arg == "--stats=json") {
+            stats = StatsFormat::Json;
+            continue;
+        }
+        if (arg == "--conditional") {
+            options.conditional = true;
+            continue;
+        }
+        if (arg == "--minify") {
+            options.minify = true;
+            continue;
+        }
+        if (arg == "--break-cycles") {
+            options.break_cycles = true;
+            continue;
+        }
+        if (arg == "--hoist-system") {
+            options.hoist_system = true;
+            continue;
+        }
+        if (arg.rfind("--system-header=", 0) == 0) {
+            options.system_header = arg.substr(16);
+            if (options.system_header.filename().empty()) return false;
+            options.hoist_system = true;
+            continue;
+        }
+        if (arg.rfind("-D", 0) == 0) {
+            if (arg.size() == 2 || arg[2] == '=') return false;
+            options.defines.push_back(arg.substr(2));
+            options.conditional = true;
+            continue;
+        }
+        const bool top = arg.rfind("--stats-top=", 0) == 0;
+        if (top) {
+            value = arg.substr(12);
+        } else if (arg.rfind("-j", 0) == 0) {
+            value = arg.substr(2);
+        } else if (arg.rfind("--jobs=", 0) == 0) {
+            value = arg.substr(7);
+        } else {
+            rest.push_back(arg);
+            continue;
+        }
+        char* end = nullptr;
+        const unsigned long number = std::strtoul(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0') return false;
+        if (top) {
+            top_files = number;
+        } else {
+            options.jobs = static_cast<unsigned>(number);
+            jobs_given = true;
+        }
+    }
+    if (stats != StatsFormat::None) options.top_files = top_files;
+    args = std::move(rest);
+    return true;
+}
+
+static void PrintStats(StatsFormat format, const v2::RunStats& stats, double wall_ms) {
+    if (format == StatsFormat::Text) v2::WriteStatsText(std::cerr, stats, wall_ms);
+    if (format == StatsFormat::Json) v2::WriteStatsJson(std::cerr, stats, wall_ms);
+}
+
+static double MsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static std::vector<fs::path> ToPaths(const std::vector<std::string>& args, std::size_t first) {
+    std::vector<fs::path> paths;
+    for (std::size_t i = first; i < args.size(); ++i) paths.push_back(fs::path(args[i]));
+    return paths;
+}
+
 int main(int argc, char** argv) {
     std::ios::sync_with_stdio(false);
     std::cin.tie(nullptr);
@@ -16,39 +122,230 @@ int main(int argc, char** argv) {
 
     // РЕЖИМ 1: тесты
     if (argc == 1) {
-        common::RunAllTests("V2", &v2::Preprocess);
+        common::RunAllTests("V2", &v2::Preprocess, &v2::tests::RunV2Tests);
         return 0;
     }
 
+    std::vector<std::string> args(argv + 1, argv + argc);
+    v2::RunOptions options;
+    bool jobs_given = false;
+    StatsFormat stats_format = StatsFormat::None;
+    if (!ExtractRunOptions(args, options, jobs_given, stats_format)) {
+        std::cerr << "bad -j/--jobs/--stats-top/-D/--system-header value\n";
+        return 2;
+    }
+
     // РЕЖИМ 2: flatten-утилита
-    // v2.exe --flatten <in> <out> [include_dir...]
-    if (std::string(argv[1]) == "--flatten") {
-        if (argc < 4) {
-            std::cerr << "usage: v2 --flatten <in_file> <out_file> [include_dir...]\n";
+    // v2.exe --flatten <in> <out> [include_dir...] [-jN] [--stats[=json]] [-DИМЯ[=значение]...] [--minify]
+    //                 [--hoist-system | --system-header=ИМЯ] [--break-cycles] [--watch]
+    // --watch: не выходить, пересклеивать после каждого сохранения (до Ctrl+C)
+    if (!args.empty() && args[0] == "--flatten") {
+        const auto watch_flag = std::find(args.begin(), args.end(), "--watch");
+        const bool watch = watch_flag != args.end();
+        if (watch) args.erase(watch_flag);
+        if (args.size() < 3) {
+            std::cerr << "usage: v2 --flatten <in_file> <out_file> [include_dir...] [-jN] [--stats[=json]] [--stats-top=N]"
+                         " [--conditional] [-DNAME[=value]...] [--minify] [--hoist-system | --system-header=NAME]"
+                         " [--break-cycles] [--watch]\n";
             return 2;
         }
-        fs::path in_file = argv[2];
-        fs::path out_file = argv[3];
+        fs::path in_file = args[1];
+        fs::path out_file = args[2];
+        std::vector<fs::path> include_dirs = ToPaths(args, 3);
+        // вывод подключает заголовок по имени — он должен лежать рядом
+        if (!options.system_header.empty()) {
+            options.system_header = out_file.parent_path() / options.system_header.filename();
+        }
 
-        std::vector<fs::path> include_dirs;
-        for (int i = 4; i < argc; ++i) include_dirs.push_back(fs::path(argv[i]));
+        if (watch) {
+            static const std::atomic<bool> never_stop{false};
+            v2::SharedCaches caches(include_dirs);
+            v2::Watch(in_file, out_file, caches, options, std::cout, never_stop);
+            return 0;
+        }
+
+        v2::RunStats stats;
+        const auto start = std::chrono::steady_clock::now();
+        bool ok = v2::FlattenProject(in_file, out_file, include_dirs, options, stats);
+        if (ok) v2::WriteOnceSummary(std::cout, stats);
+        PrintStats(stats_format, stats, MsSince(start));
+        return ok ? 0 : 1;
+    }
 
-        bool ok = v2::FlattenProject(in_file, out_file, include_dirs);
+    // РЕЖИМ 3: batch — много пар за один запуск, общий кэш, пул потоков
+    // v2.exe --batch <manifest|-> [--flatten] [include_dir...] [-jN] [--stats[=json]] [-DИМЯ[=значение]...]
+    //                [--minify] [--hoist-system] [--break-cycles]
+    if (!args.empty() && args[0] == "--batch") {
+        if (args.size() < 2 || !options.system_header.empty()) {
+            std::cerr << "usage: v2 --batch <manifest|-> [--flatten] [include_dir...] [-jN] [--stats[=json]]"
+                         " [--stats-top=N] [--conditional] [-DNAME[=value]...] [--minify] [--hoist-system]"
+                         " [--break-cycles]\n";
+            return 2;
+        }
+        const std::string manifest = args[1];
+        std::size_t first_dir = 2;
+        v2::Mode mode = v2::Mode::TZ;
+        if (args.size() > 2 && args[2] == "--flatten") {
+            mode = v2::Mode::Flatten;
+            first_dir = 3;
+        }
+        std::vector<fs::path> include_dirs = ToPaths(args, first_dir);
+
+        std::vector<v2::BatchJob> jobs;
+        std::string error;
+        bool read_ok = false;
+        if (manifest == "-") {
+            read_ok = v2::ReadBatchManifest(std::cin, jobs, error);
+        } else {
+            std::ifstream in(manifest);
+            if (!in.is_open()) {
+                std::cerr << "cannot open manifest " << manifest << "\n";
+                return 2;
+            }
+            read_ok = v2::ReadBatchManifest(in, jobs, error);
+        }
+        if (!read_ok) {
+            std::cerr << error << "\n";
+            return 2;
+        }
+
+        // в batch -jN — размер пула по TU (по умолчанию — по числу ядер)
+        const unsigned threads = jobs_given ? options.jobs : 0;
+        const v2::BatchReport report = v2::RunBatch(jobs, include_dirs, mode, options, threads);
+
+        // сообщения — в порядке манифеста, как при последовательных запусках
+        v2::RunStats stats;
+        for (const auto& job : jobs) {
+            std::cout << job.messages;
+            v2::AddRunStats(stats, job.stats, options.top_files);
+        }
+        PrintStats(stats_format, stats, report.wall_ms);
+
+        std::cout << "batch: " << jobs.size() << " TU, ok " << report.ok << ", failed " << report.failed
+                  << ", wall " << report.wall_ms << " ms\n";
+        for (std::size_t w = 0; w < report.workers.size(); ++w) {
+            const auto& worker = report.workers[w];
+            const double util = report.wall_ms > 0 ? 100.0 * worker.busy_ms / report.wall_ms : 0.0;
+            std::cout << "  worker " << w << ": jobs " << worker.jobs << ", busy " << worker.busy_ms
+                      << " ms, util " << util << "%\n";
+        }
+        return report.failed == 0 ? 0 : 1;
+    }
+
+    // РЕЖИМ 4: только граф include — depfile для make/ninja и (по желанию) JSON/DOT
+    // v2.exe --deps <in> <depfile> [include_dir...] [--flatten] [--target=T] [--graph=<file.json|file.dot>]
+    if (!args.empty() && args[0] == "--deps") {
+        v2::Mode mode = v2::Mode::TZ;
+        std::string target;
+        fs::path graph_file;
+        std::vector<std::string> positional;
+        for (std::size_t i = 1; i < args.size(); ++i) {
+            if (args[i] == "--flatten") {
+                mode = v2::Mode::Flatten;
+            } else if (args[i].rfind("--target=", 0) == 0) {
+                target = args[i].substr(9);
+            } else if (args[i].rfind("--graph=", 0) == 0) {
+                graph_file = args[i].substr(8);
+            } else {
+                positional.push_back(args[i]);
+            }
+        }
+        if (positional.size() < 2) {
+            std::cerr << "usage: v2 --deps <in_file> <depfile> [include_dir...] [--flatten] [--target=T]"
+                         " [--graph=<file.json|file.dot>]\n";
+            return 2;
+        }
+        const fs::path in_file = positional[0];
+        const fs::path depfile = positional[1];
+        if (target.empty()) target = fs::path(in_file).replace_extension(".o").generic_string();
+
+        v2::SharedCaches caches(ToPaths(positional, 2));
+        v2::IncludeGraph graph;
+        v2::RunStats stats;
+        const bool ok = v2::ScanIncludeGraph(in_file, mode, caches, graph, stats, std::cout);
+        if (!ok) return 1;
+
+        std::ofstream dep_out(depfile);
+        if (!dep_out.is_open()) return 1;
+        v2::WriteDepfile(dep_out, target, graph);
+
+        if (!graph_file.empty()) {
+            std::ofstream graph_out(graph_file);
+            if (!graph_out.is_open()) return 1;
+            if (graph_file.extension() == ".dot") v2::WriteGraphDot(graph_out, graph);
+            else v2::WriteGraphJson(graph_out, graph);
+        }
+        return 0;
+    }
+
+    // РЕЖИМ 5: сервер — запросы tz/flatten построчно из stdin, кэши живут между ними
+    // v2.exe --serve [include_dir...] [-jN]
+    if (!args.empty() && args[0] == "--serve") {
+        v2::SharedCaches caches(ToPaths(args, 1));
+        const v2::ServeReport report = v2::Serve(std::cin, std::cout, caches, options);
+        std::cerr << "serve: запросов " << report.requests << ", с ошибкой " << report.failed
+                  << ", файлов перечитано после изменений " << report.files_dropped
+                  << ", сбросов поиска include " << report.resolver_resets << "\n";
+        return 0;
+    }
+
+    // РЕЖИМ 6: unity build — TU из списка склеиваются в N файлов для параллельной компиляции
+    // v2.exe --unity <list|-> <out_dir> [include_dir...] [--shards=N] [--minify] [--hoist-system]
+    if (!args.empty() && args[0] == "--unity") {
+        std::size_t shards = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::string> positional;
+        for (std::size_t i = 1; i < args.size(); ++i) {
+            if (args[i].rfind("--shards=", 0) == 0) {
+                shards = std::strtoul(args[i].c_str() + 9, nullptr, 10);
+            } else {
+                positional.push_back(args[i]);
+            }
+        }
+        if (positional.size() < 2 || shards == 0) {
+            std::cerr << "usage: v2 --unity <list|-> <out_dir> [include_dir...] [--shards=N] [--minify]"
+                         " [--hoist-system]\n";
+            return 2;
+        }
+        std::vector<fs::path> units;
+        if (positional[0] == "-") {
+            units = v2::ReadUnitList(std::cin);
+        } else {
+            std::ifstream list(positional[0]);
+            if (!list.is_open()) {
+                std::cerr << "cannot open list " << positional[0] << "\n";
+                return 2;
+            }
+            units = v2::ReadUnitList(list);
+        }
+
+        v2::SharedCaches caches(ToPaths(positional, 2));
+        std::vector<v2::UnityShard> result;
+        v2::RunStats stats;
+        const auto start = std::chrono::steady_clock::now();
+        const bool ok = v2::FlattenShards(units, positional[1], shards, caches, options, result, stats, std::cout);
+        for (const v2::UnityShard& shard : result) {
+            std::cout << "unity: " << shard.out_file.generic_string() << ": TU " << shard.units.size()
+                      << ", цена " << shard.cost << " байт\n";
+        }
+        PrintStats(stats_format, stats, MsSince(start));
         return ok ? 0 : 1;
     }
 
-    // РЕЖИМ 3: ТЗ-утилита
-    // v2.exe <in> <out> [include_dir...]
-    if (argc < 3) {
-        std::cerr << "usage: v2 <in_file> <out_file> [include_dir...]\n";
+    // РЕЖИМ 7: ТЗ-утилита
+    // v2.exe <in> <out> [include_dir...] [-jN] [--stats[=json]] [-DИМЯ[=значение]...]
+    if (args.size() < 2) {
+        std::cerr << "usage: v2 <in_file> <out_file> [include_dir...] [-jN] [--stats[=json]] [--stats-top=N]"
+                     " [--conditional] [-DNAME[=value]...] [--minify]\n";
         return 2;
     }
 
-    fs::path in_file = argv[1];
-    fs::path out_file = argv[2];
-    std::vector<fs::path> include_dirs;
-    for (int i = 3; i < argc; ++i) include_dirs.push_back(fs::path(argv[i]));
+    fs::path in_file = args[0];
+    fs::path out_file = args[1];
+    std::vector<fs::path> include_dirs = ToPaths(args, 2);
 
-    bool ok = v2::Preprocess(in_file, out_file, include_dirs);
+    v2::RunStats stats;
+    const auto start = std::chrono::steady_clock::now();
+    bool ok = v2::Preprocess_TZ(in_file, out_file, include_dirs, options, stats);
+    PrintStats(stats_format, stats, MsSince(start));
     return ok ? 0 : 1;
 }
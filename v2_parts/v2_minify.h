@@ -0,0 +1,315 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "v2_output.h"
+
+namespace v2 {
+
+// =======================
+// --minify: убрать из результата комментарии и пустые строки, сжать пробелы
+// =======================
+//
+// Лексер по ходу записи: MinifySink стоит перед настоящим приёмником и отдаёт
+// ему куски входа как есть (без копирования), пропуская комментарии, отступы,
+// хвостовые пробелы и пустые строки. Состояние переживает границы кусков,
+// так что файл может прийти любыми частями.
+//
+// Что не трогается: строковые и символьные литералы (с escape), raw-строки
+// R"d(...)d" (включая префиксы u8R/uR/UR/LR), разделители разрядов 1'000,
+// продолжения строк '\' (после них отступ сжимается до одного пробела, а не
+// убирается: "a\<перевод строки>  b" не должно склеиться в "ab").
+// Комментарий, как и у компилятора, равен одному пробелу.
+
+class MinifySink final : public OutputSink {
+public:
+    explicit MinifySink(OutputSink& inner) : inner_(inner) {}
+
+    // Куски входа уходят в inner как есть: text должен жить до Close(), как и для inner
+    void Write(std::string_view text) override {
+        bytes_in_ += text.size();
+        text_ = text;
+        run_ = 0;
+        ws_start_ = 0;
+        std::size_t i = 0;
+        if (slash_pending_) {
+            slash_pending_ = false;
+            if (!text.empty() && (text[0] == '/' || text[0] == '*')) {
+                state_ = text[0] == '/' ? State::LineComment : State::BlockComment;
+                i = 1;
+                run_ = 1;
+            } else {
+                // '/' из прошлого куска — обычный символ
+                EmitPendingSpace(0);
+                Emit("/");
+                Content('/');
+            }
+        }
+        for (; i < text.size(); ++i) Step(i);
+
+        switch (state_) {
+            case State::Code:
+                Flush(pending_ws_ ? ws_start_ : text.size());
+                if (pending_ws_) ws_simple_ = false;  // пробел уже отделён от текста — вставим свой
+                break;
+            case State::LineComment:
+            case State::BlockComment:
+                break;
+            default:
+                Flush(text.size());
+        }
+    }
+
+    bool Close() override {
+        if (slash_pending_) {
+            EmitPendingSpace(0);
+            Emit("/");
+            slash_pending_ = false;
+        }
+        const bool ok = inner_.Close();
+        stats_ = inner_.Stats();
+        return ok;
+    }
+
+    void Discard() override {
+        inner_.Discard();
+        stats_ = inner_.Stats();
+    }
+
+    // Сколько байт пришло до минификации (после — Stats().bytes)
+    std::uint64_t BytesIn() const { return bytes_in_; }
+
+private:
+    enum class State { Code, LineComment, BlockComment, String, Char, RawDelim, Raw };
+
+    static constexpr std::size_t kMaxRawDelim = 16;  // как в стандарте
+
+    static bool IsSpace(char c) { return c == ' ' || c == '\t' || c == '\v' || c == '\f' || c == '\r'; }
+    static bool IsIdentChar(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+    }
+
+    void Emit(std::string_view s) {
+        if (!s.empty()) inner_.Write(s);
+    }
+
+    // Отдаёт [run_, upto) текущего куска
+    void Flush(std::size_t upto) {
+        if (upto > run_) Emit(text_.substr(run_, upto - run_));
+        run_ = upto;
+    }
+
+    // Перед значимым символом в позиции i: пробелы перед ним — один ' '
+    void EmitPendingSpace(std::size_t i) {
+        if (!pending_ws_) return;
+        pending_ws_ = false;
+        if (ws_simple_) return;  // ровно один ' ' внутри run_ — уже на месте
+        Flush(ws_start_);
+        Emit(" ");
+        run_ = i;
+    }
+
+    // Значимый символ кода: строка больше не пустая, отслеживаем идентификатор
+    void Content(char c) {
+        line_content_ = true;
+        last_ = c;
+        if (IsIdentChar(c)) {
+            if (ident_len_ == 0) number_ = c >= '0' && c <= '9';
+            if (ident_len_ < sizeof(ident_)) ident_[ident_len_] = c;
+            ++ident_len_;
+        } else {
+            ident_len_ = 0;
+        }
+    }
+
+    // R"( ... )" : перед кавычкой стоит один из префиксов raw-строки
+    bool RawPrefix() const {
+        const std::string_view id(ident_, ident_len_ <= sizeof(ident_) ? ident_len_ : 0);
+        return id == "R" || id == "u8R" || id == "uR" || id == "UR" || id == "LR";
+    }
+
+    void Step(std::size_t i) {
+        const char c = text_[i];
+        if (skip_) {
+            skip_ = false;
+            return;
+        }
+        switch (state_) {
+            case State::Code: return StepCode(i, c);
+            case State::LineComment:
+                if (c == '\n' && !escape_) {
+                    state_ = State::Code;
+                    run_ = i;
+                    StepCode(i, c);
+                    return;
+                }
+                escape_ = c == '\\' || (escape_ && c == '\r');  // '\' в конце строки продолжает комментарий
+                return;
+            case State::BlockComment:
+                if (escape_ && c == '/') {
+                    state_ = State::Code;
+                    escape_ = false;
+                    run_ = i + 1;
+                    if (line_content_ && !pending_ws_) {
+                        pending_ws_ = true;
+                        ws_start_ = i + 1;
+                    }
+                    if (pending_ws_) ws_simple_ = false;
+                    return;
+                }
+                escape_ = c == '*';
+                return;
+            case State::String:
+            case State::Char: {
+                const char quote = state_ == State::String ? '"' : '\'';
+                if (escape_) {
+                    escape_ = false;
+                } else if (c == '\\') {
+                    escape_ = true;
+                } else if (c == quote || c == '\n') {
+                    // перевод строки без '\' — литерал битый, дальше снова код
+                    state_ = State::Code;
+                    if (c == '\n') StepCode(i, c);
+                    else last_ = c;
+                }
+                return;
+            }
+            case State::RawDelim:
+                if (c == '(') {
+                    state_ = State::Raw;
+                    raw_match_ = 0;
+                } else if (c == ')' || c == '\\' || c == '"' || IsSpace(c) || c == '\n' || raw_delim_len_ == kMaxRawDelim) {
+                    // не raw-строка — читаем как обычную
+                    state_ = c == '"' ? State::Code : State::String;
+                } else {
+                    raw_delim_[raw_delim_len_++] = c;
+                }
+                return;
+            case State::Raw: {
+                // конец — ")" + разделитель + '"'; ')' внутри разделителя не бывает
+                const std::size_t term_len = raw_delim_len_ + 2;
+                const char expected = raw_match_ == 0 ? ')' : raw_match_ == term_len - 1 ? '"' : raw_delim_[raw_match_ - 1];
+                if (c == expected) {
+                    if (++raw_match_ == term_len) {
+                        state_ = State::Code;
+                        last_ = c;
+                    }
+                } else {
+                    raw_match_ = c == ')' ? 1 : 0;
+                }
+                return;
+            }
+        }
+    }
+
+    void StepCode(std::size_t i, char c) {
+        if (c == '\n') {
+            if (pending_ws_) {
+                Flush(ws_start_);  // хвостовые пробелы не нужны
+                run_ = i;
+                pending_ws_ = false;
+            }
+            if (line_content_) {
+                // '\' + перевод строки: строка продолжается, её отступ станет пробелом
+                line_content_ = last_ == '\\';
+            } else {
+                Flush(i);  // пустая строка — без перевода строки
+                run_ = i + 1;
+            }
+            last_ = c;
+            ident_len_ = 0;
+            return;
+        }
+
+        if (IsSpace(c)) {
+            ident_len_ = 0;
+            if (!line_content_) {
+                Flush(i);  // отступ
+                run_ = i + 1;
+                return;
+            }
+            if (!pending_ws_) {
+                pending_ws_ = true;
+                ws_start_ = i;
+                ws_simple_ = c == ' ';
+            } else {
+                ws_simple_ = false;
+            }
+            return;
+        }
+
+        if (c == '/') {
+            if (i + 1 == text_.size()) {
+                // решится в следующем куске
+                Flush(pending_ws_ ? ws_start_ : i);
+                if (pending_ws_) ws_simple_ = false;
+                slash_pending_ = true;
+                run_ = i + 1;
+                return;
+            }
+            const char next = text_[i + 1];
+            if (next == '/' || next == '*') {
+                Flush(pending_ws_ ? ws_start_ : i);
+                if (pending_ws_) ws_simple_ = false;
+                state_ = next == '/' ? State::LineComment : State::BlockComment;
+                escape_ = false;
+                skip_ = true;  // '*' из "/*" не закрывает комментарий: "/*/" — ещё не конец
+                run_ = i + 2;
+                return;
+            }
+        }
+
+        EmitPendingSpace(i);
+
+        if (c == '"') {
+            if (RawPrefix()) {
+                state_ = State::RawDelim;
+                raw_delim_len_ = 0;
+            } else {
+                state_ = State::String;
+                escape_ = false;
+            }
+            Content(c);
+            return;
+        }
+        if (c == '\'' && !(ident_len_ > 0 && number_)) {
+            state_ = State::Char;
+            escape_ = false;
+            Content(c);
+            return;
+        }
+        if (c == '\'') {
+            last_ = c;  // 1'000 — разделитель разрядов, число продолжается
+            return;
+        }
+        Content(c);
+    }
+
+    OutputSink& inner_;
+    std::uint64_t bytes_in_ = 0;
+
+    std::string_view text_;   // текущий кусок
+    std::size_t run_ = 0;     // начало ещё не отданной части куска
+    std::size_t ws_start_ = 0;  // где в куске начались отложенные пробелы
+
+    State state_ = State::Code;
+    bool line_content_ = false;  // в текущей строке вывода уже есть что-то кроме пробелов
+    bool pending_ws_ = false;    // пробелы после текста, ещё не решили, нужны ли
+    bool ws_simple_ = false;     // отложенные пробелы — ровно один ' ' внутри run_
+    bool slash_pending_ = false;  // кусок кончился на '/': комментарий или деление — видно дальше
+    bool escape_ = false;        // строка: был '\'; блочный комментарий: был '*'; строчный: был '\'
+    bool skip_ = false;          // второй символ "//" или "/*"
+    char last_ = '\n';           // последний значимый символ кода
+
+    char ident_[3] = {};         // начало текущего идентификатора (для префикса raw-строки)
+    std::size_t ident_len_ = 0;
+    bool number_ = false;        // текущий "идентификатор" — число (для 1'000)
+
+    char raw_delim_[kMaxRawDelim] = {};
+    std::size_t raw_delim_len_ = 0;
+    std::size_t raw_match_ = 0;
+};
+
+} // namespace v2
@@ -0,0 +1,479 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "../common/changed_file.h"
+#include "v2_source.h"
+#include "v2_vfs.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define V2_HAVE_WRITEV 1
+#endif
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#define V2_HAVE_SPLICE 1
+#endif
+
+namespace v2 {
+namespace fs = std::filesystem;
+
+// =======================
+// Вывод: куски текста уходят в файл пачками writev прямо из буферов входа,
+// а длинные нетронутые куски исходных файлов — copy_file_range/sendfile
+// (данные копирует ядро, в память процесса они не попадают)
+// =======================
+
+struct OutputStats {
+    std::uint64_t bytes = 0;          // всего записано
+    std::uint64_t bytes_spliced = 0;  // из них скопировано ядром (copy_file_range/sendfile)
+    std::size_t write_calls = 0;      // writev / ofstream::write
+    std::size_t splice_calls = 0;     // copy_file_range / sendfile
+    std::uint64_t write_ns = 0;       // время в этих вызовах
+    std::size_t files_unchanged = 0;  // выходных файлов совпало с прежними — не переписаны
+};
+
+inline OutputStats& operator+=(OutputStats& to, const OutputStats& d) {
+    to.bytes += d.bytes;
+    to.bytes_spliced += d.bytes_spliced;
+    to.write_calls += d.write_calls;
+    to.splice_calls += d.splice_calls;
+    to.write_ns += d.write_ns;
+    to.files_unchanged += d.files_unchanged;
+    return to;
+}
+
+// Куда идёт результат. Движок пишет только целыми строками через WriteText;
+// WriteTextFromFile — подсказка, что кусок лежит в файле на диске как есть.
+class OutputSink {
+public:
+    virtual ~OutputSink() = default;
+
+    // text должен оставаться живым до Close(): приёмник вправе его не копировать
+    virtual void Write(std::string_view text) = 0;
+
+    // Целые строки как есть; последней строке без '\n' он добавляется
+    void WriteText(std::string_view text) {
+        if (text.empty()) return;
+        Write(text);
+        if (text.back() != '\n') Write("\n");
+    }
+
+    // То же, но text — побайтная копия [offset, offset + size) файла src
+    // в версии version (какой он был при чтении)
+    virtual void WriteTextFromFile(std::string_view text, const fs::path& src, std::uint64_t offset,
+                                   const FileStamp& version) {
+        (void)src;
+        (void)offset;
+        (void)version;
+        WriteText(text);
+    }
+
+    // Конец вывода. false — что-то не записалось.
+    virtual bool Close() { return true; }
+
+    // Конец вывода, который не нужен (прогон не удался): файл на диске остаётся
+    // прежним. Приёмникам, которым нечего откатывать, — то же, что Close().
+    virtual void Discard() { Close(); }
+
+    const OutputStats& Stats() const { return stats_; }
+
+protected:
+    OutputStats stats_;
+};
+
+// В строку (встраивание, тесты)
+class StringSink final : public OutputSink {
+public:
+    void Write(std::string_view text) override {
+        text_.append(text.data(), text.size());
+        stats_.bytes += text.size();
+    }
+
+    const std::string& Text() const { return text_; }
+    std::string Take() { return std::move(text_); }
+
+private:
+    std::string text_;
+};
+
+// Откладывает вывод: куски запоминаются (без копирования текста) и уходят
+// в другой приёмник по Replay — когда перед ними надо записать что-то ещё
+class DeferredSink final : public OutputSink {
+public:
+    void Write(std::string_view text) override { pieces_.push_back({text, nullptr, 0, nullptr}); }
+
+    void WriteTextFromFile(std::string_view text, const fs::path& src, std::uint64_t offset,
+                           const FileStamp& version) override {
+        if (!text.empty()) pieces_.push_back({text, &src, offset, &version});
+    }
+
+    // src и version из WriteTextFromFile должны быть живы до Replay
+    void Replay(OutputSink& out) const {
+        for (const Piece& piece : pieces_) {
+            if (piece.src) out.WriteTextFromFile(piece.text, *piece.src, piece.offset, *piece.version);
+            else out.Write(piece.text);
+        }
+    }
+
+private:
+    struct Piece {
+        std::string_view text;
+        const fs::path* src;  // не nullptr — кусок файла (подсказка для WriteTextFromFile)
+        std::uint64_t offset;
+        const FileStamp* version;
+    };
+    std::vector<Piece> pieces_;
+};
+
+// В поток; Close() только сбрасывает буфер — поток закрывает владелец
+class StreamSink final : public OutputSink {
+public:
+    explicit StreamSink(std::ostream& out) : out_(out) {}
+
+    void Write(std::string_view text) override {
+        out_.write(text.data(), static_cast<std::streamsize>(text.size()));
+        ++stats_.write_calls;
+        stats_.bytes += text.size();
+    }
+
+    bool Close() override {
+        out_.flush();
+        return static_cast<bool>(out_);
+    }
+
+private:
+    std::ostream& out_;
+};
+
+// Каждый кусок — в функцию. Кусок действителен только на время вызова.
+class CallbackSink final : public OutputSink {
+public:
+    explicit CallbackSink(std::function<void(std::string_view)> callback) : callback_(std::move(callback)) {}
+
+    void Write(std::string_view text) override {
+        if (text.empty()) return;
+        callback_(text);
+        ++stats_.write_calls;
+        stats_.bytes += text.size();
+    }
+
+private:
+    std::function<void(std::string_view)> callback_;
+};
+
+// В файл на диске: writev пачками, длинные нетронутые куски — ядром.
+// Файл переписывается, только если результат отличается от прежнего: пока
+// вывод совпадает с отображением прежнего файла, писать нечего; на первом
+// отличии совпавшее начало копируется ядром во временный файл рядом, дальше
+// пишется туда, а Close() подменяет им прежний (rename). Не изменился —
+// прежний файл и его mtime не тронуты (Stats().files_unchanged).
+class OutputWriter final : public OutputSink {
+public:
+    // Куски короче этого дешевле отдать writev, чем открывать исходный файл
+    static constexpr std::size_t kSpliceMin = 64 * 1024;
+
+    OutputWriter() = default;
+    OutputWriter(const OutputWriter&) = delete;
+    OutputWriter& operator=(const OutputWriter&) = delete;
+    ~OutputWriter() { Close(); }
+
+    // false — вывод не создать
+    bool Open(const fs::path& out_file) {
+#ifdef V2_HAVE_WRITEV
+        target_ = common::ReplaceTarget(out_file);
+        temp_.clear();
+        open_ = true;
+        same_ = 0;
+        struct stat st {};
+        if (::stat(target_.c_str(), &st) == 0 && !S_ISREG(st.st_mode)) {
+            // /dev/stdout, FIFO: сравнивать не с чем и заменять нечего
+            comparing_ = false;
+            fd_ = ::open(target_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            return fd_ >= 0;
+        }
+        comparing_ = old_.Open(target_);
+        had_old_ = comparing_;
+        return comparing_ || Diverge();
+#else
+        return stream_.Open(out_file);  // текстовый режим, как раньше у ofstream в движке
+#endif
+    }
+
+    // Для бенчмарка и ФС, где копирование в ядре только мешает
+    void SetSpliceEnabled(bool enabled) { splice_enabled_ = enabled; }
+
+    // text должен оставаться живым до Flush()/Close(): он не копируется
+    void Write(std::string_view text) override {
+        if (text.empty()) return;
+#ifdef V2_HAVE_WRITEV
+        if (comparing_ && Same(text)) return;
+        pending_.push_back({const_cast<char*>(text.data()), text.size()});
+        if (pending_.size() >= kMaxIov) Flush();
+#else
+        const WriteTimer timer(stats_.write_ns);
+        stream_.write(text.data(), static_cast<std::streamsize>(text.size()));
+        ++stats_.write_calls;
+        stats_.bytes += text.size();
+#endif
+    }
+
+    // Длинный кусок копируется ядром из файла src в файл вывода — если файл
+    // всё ещё той версии, из которой text; иначе (сохранили после чтения) пишется сам text
+    void WriteTextFromFile(std::string_view text, const fs::path& src, std::uint64_t offset,
+                           const FileStamp& version) override {
+        if (text.empty()) return;
+#ifdef V2_HAVE_SPLICE
+        if (!comparing_ && splice_enabled_ && text.size() >= kSpliceMin && SourceIs(src, version) &&
+            Splice(src, offset, text.size())) {
+            if (text.back() != '\n') Write("\n");
+            return;
+        }
+#else
+        (void)src;
+        (void)offset;
+        (void)version;
+#endif
+        WriteText(text);
+    }
+
+    bool Flush() {
+#ifdef V2_HAVE_WRITEV
+        if (pending_.empty()) return !failed_;
+        const WriteTimer timer(stats_.write_ns);
+        std::size_t i = 0;
+        while (i < pending_.size()) {
+            const int count = static_cast<int>(std::min<std::size_t>(pending_.size() - i, kMaxIov));
+            const ssize_t n = ::writev(fd_, pending_.data() + i, count);
+            ++stats_.write_calls;
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                failed_ = true;
+                break;
+            }
+            stats_.bytes += static_cast<std::uint64_t>(n);
+            // частичная запись: сдвигаем первый недописанный кусок
+            std::size_t left = static_cast<std::size_t>(n);
+            while (i < pending_.size() && left >= pending_[i].iov_len) left -= pending_[i++].iov_len;
+            if (left > 0) {
+                pending_[i].iov_base = static_cast<char*>(pending_[i].iov_base) + left;
+                pending_[i].iov_len -= left;
+            }
+        }
+        pending_.clear();
+        return !failed_;
+#else
+        stream_.flush();
+        return static_cast<bool>(stream_);
+#endif
+    }
+
+    // false — что-то не записалось (прежний файл тогда цел)
+    bool Close() override {
+#ifdef V2_HAVE_WRITEV
+        if (!open_) return !failed_;
+        open_ = false;
+        // вывод — начало прежнего файла: он всё же изменился
+        if (comparing_ && same_ != old_.View().size() && !Diverge()) failed_ = true;
+        if (comparing_) {
+            comparing_ = false;
+            old_ = SourceBuffer();
+            ++stats_.files_unchanged;
+            return !failed_;
+        }
+        if (fd_ >= 0) {
+            Flush();
+            CloseSources();
+            if (::close(fd_) != 0) failed_ = true;
+            fd_ = -1;
+        }
+        old_ = SourceBuffer();
+        if (temp_.empty()) return !failed_;
+        std::error_code ec;
+        if (failed_) {
+            fs::remove(temp_, ec);
+            return false;
+        }
+        if (!common::ReplaceFile(temp_, target_, had_old_)) failed_ = true;
+        return !failed_;
+#else
+        if (!stream_.Commit()) return false;
+        if (!stream_.Changed()) ++stats_.files_unchanged;
+        return true;
+#endif
+    }
+
+    void Discard() override {
+#ifdef V2_HAVE_WRITEV
+        if (!open_) return;
+        open_ = false;
+        comparing_ = false;
+        pending_.clear();
+        CloseSources();
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+        old_ = SourceBuffer();
+        std::error_code ec;
+        if (!temp_.empty()) fs::remove(temp_, ec);
+#else
+        stream_.Discard();
+#endif
+    }
+
+private:
+    // Время системных вызовов записи — в OutputStats::write_ns
+    struct WriteTimer {
+        explicit WriteTimer(std::uint64_t& to) : to_(to), start_(std::chrono::steady_clock::now()) {}
+        ~WriteTimer() {
+            to_ += static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start_).count());
+        }
+        std::uint64_t& to_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+#ifdef V2_HAVE_WRITEV
+    static constexpr std::size_t kMaxIov = 1024;  // IOV_MAX в Linux
+
+    // Кусок совпал с прежним файлом на своём месте — писать его не нужно
+    bool Same(std::string_view text) {
+        const std::string_view old = old_.View();
+        if (old.size() - same_ >= text.size() && std::memcmp(old.data() + same_, text.data(), text.size()) == 0) {
+            same_ += text.size();
+            stats_.bytes += text.size();
+            return true;
+        }
+        if (!Diverge()) failed_ = true;
+        return false;
+    }
+
+    // Дальше — во временный файл; совпавшие same_ байт прежнего файла копируются в него первыми
+    bool Diverge() {
+        comparing_ = false;
+        temp_ = common::TempPathFor(target_);
+        fd_ = ::open(temp_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd_ < 0) {
+            temp_.clear();
+            return false;
+        }
+        if (same_ == 0) return true;
+        stats_.bytes -= same_;  // посчитаются заново как записанные
+#ifdef V2_HAVE_SPLICE
+        if (splice_enabled_ && Splice(target_, 0, same_)) return !failed_;
+#endif
+        pending_.push_back({const_cast<char*>(old_.View().data()), same_});  // old_ жив до Close()
+        return true;
+    }
+#endif
+
+#ifdef V2_HAVE_SPLICE
+    // Последние открытые исходники: один файл обычно даёт несколько длинных кусков подряд
+    static constexpr std::size_t kMaxSources = 16;
+
+    int SourceFd(const fs::path& src) {
+        for (auto it = sources_.begin(); it != sources_.end(); ++it) {
+            if (it->first == src) {
+                sources_.splice(sources_.begin(), sources_, it);
+                return it->second;
+            }
+        }
+        const int fd = ::open(src.c_str(), O_RDONLY);
+        if (fd < 0) return -1;
+        sources_.emplace_front(src, fd);
+        if (sources_.size() > kMaxSources) {
+            ::close(sources_.back().second);
+            sources_.pop_back();
+        }
+        return fd;
+    }
+
+    // Файл под именем src — всё ещё та версия, что разобрана? Иначе байты по
+    // смещениям разбора в нём уже другие
+    bool SourceIs(const fs::path& src, const FileStamp& version) {
+        const int in_fd = SourceFd(src);
+        struct stat st {};
+        return in_fd >= 0 && ::fstat(in_fd, &st) == 0 && StampFromStat(st) == version;
+    }
+
+    bool Splice(const fs::path& src, std::uint64_t offset, std::size_t size) {
+        if (!Flush()) return false;
+        const int in_fd = SourceFd(src);
+        if (in_fd < 0) return false;
+        const WriteTimer timer(stats_.write_ns);
+
+        off_t in_off = static_cast<off_t>(offset);
+        std::size_t done = 0;
+        while (done < size) {
+            ssize_t n = -1;
+            if (use_copy_file_range_) {
+                n = ::copy_file_range(in_fd, &in_off, fd_, nullptr, size - done, 0);
+                if (n < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+                    use_copy_file_range_ = false;  // эта пара ФС не умеет — дальше sendfile
+                    continue;
+                }
+            } else {
+                n = ::sendfile(fd_, in_fd, &in_off, size - done);
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            ++stats_.splice_calls;
+            done += static_cast<std::size_t>(n);
+        }
+        stats_.bytes += done;
+        stats_.bytes_spliced += done;
+        if (done == size) return true;
+
+        // ядро не справилось (не та ФС, файл укоротили) — если ничего не записали,
+        // отдадим кусок обычной записью; иначе вывод уже испорчен
+        if (done > 0) failed_ = true;
+        splice_enabled_ = false;
+        return done > 0;
+    }
+
+    void CloseSources() {
+        for (auto& src : sources_) ::close(src.second);
+        sources_.clear();
+    }
+
+    std::list<std::pair<fs::path, int>> sources_;
+    bool use_copy_file_range_ = true;
+#else
+    void CloseSources() {}
+#endif
+
+#ifdef V2_HAVE_WRITEV
+    int fd_ = -1;
+    std::vector<iovec> pending_;
+    fs::path target_;
+    fs::path temp_;             // временный файл; пусто — пишем прямо в target_ или ещё не начали
+    SourceBuffer old_;          // прежний файл, с которым сверяемся
+    std::uint64_t same_ = 0;    // столько байт вывода совпало с его началом
+    bool open_ = false;
+    bool comparing_ = false;    // пока всё совпадает — на диск ничего не пишется
+    bool had_old_ = false;
+#else
+    common::ChangedFile stream_;
+#endif
+    bool splice_enabled_ = true;
+    bool failed_ = false;
+};
+
+} // namespace v2
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "v2_file_cache.h"
+#include "v2_resolver.h"
+
+namespace v2 {
+namespace fs = std::filesystem;
+
+// =======================
+// Параллельная предзагрузка дерева include одного TU
+// =======================
+//
+// Файлы дерева читаются и разбираются пулом потоков, include каждого файла
+// сразу ищутся резолвером, найденные дети ставятся в очередь. После этого
+// обычный последовательный проход собирает вывод уже целиком из кэшей —
+// поэтому порядок вывода и место первой ошибки те же, что без предзагрузки.
+
+struct PrefetchStats {
+    FileCacheStats files;
+    ResolverStats resolver;
+    std::size_t files_visited = 0;
+};
+
+inline PrefetchStats PrefetchIncludeTree(const fs::path& root,
+                                         bool expand_angle,
+                                         FileCache& files,
+                                         IncludeResolver& resolver,
+                                         unsigned threads) {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<fs::path> queue{root};
+    std::unordered_set<std::string> visited{root.string()};
+    std::size_t in_flight = 0;  // взятые из очереди, но ещё не разобранные
+
+    std::vector<PrefetchStats> per_worker(std::max(1u, threads));
+
+    auto worker = [&](PrefetchStats& me) {
+        for (;;) {
+            fs::path current;
+            {
+                std::unique_lock lock(mutex);
+                cv.wait(lock, [&] { return !queue.empty() || in_flight == 0; });
+                if (queue.empty()) return;  // очередь пуста и никто ничего не добавит
+                current = std::move(queue.front());
+                queue.pop_front();
+                ++in_flight;
+            }
+
+            std::vector<fs::path> children;
+            if (const ParsedFile* file = files.Load(current, &me.files)) {
+                ++me.files_visited;
+                const fs::path here = current.parent_path();
+                for (const Segment& seg : file->segments) {
+                    const bool quoted = seg.kind == SegmentKind::IncludeQuote;
+                    if (!quoted && !(expand_angle && seg.kind == SegmentKind::IncludeAngle)) continue;
+                    if (const fs::path* target = resolver.Resolve(here, seg.token, quoted, &me.resolver)) {
+                        children.push_back(*target);
+                    }
+                }
+            }
+
+            {
+                std::lock_guard lock(mutex);
+                for (auto& child : children) {
+                    if (visited.insert(child.string()).second) queue.push_back(std::move(child));
+                }
+                --in_flight;
+            }
+            cv.notify_all();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (std::size_t t = 1; t < per_worker.size(); ++t) pool.emplace_back(worker, std::ref(per_worker[t]));
+    worker(per_worker[0]);
+    for (auto& th : pool) th.join();
+
+    PrefetchStats total;
+    for (const PrefetchStats& s : per_worker) {
+        total.files += s.files;
+        total.resolver += s.resolver;
+        total.files_visited += s.files_visited;
+    }
+    return total;
+}
+
+} // namespace v2
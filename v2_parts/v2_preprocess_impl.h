@@ -1,234 +1,491 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
 #include <filesystem>
-#include <fstream>
-#include <functional>
 #include <iostream>
-#include <regex>
+#include <optional>
+#include <ostream>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
+#include "../common/include_cycle.h"
+#include "v2_conditional.h"
+#include "v2_file_cache.h"
+#include "v2_hoist.h"
+#include "v2_minify.h"
+#include "v2_output.h"
+#include "v2_parallel.h"
+#include "v2_resolver.h"
+
 namespace v2 {
 namespace fs = std::filesystem;
 
-inline void StripUtf8BOM(std::string& s) {
-    if (s.size() >= 3 &&
-        static_cast<unsigned char>(s[0]) == 0xEF &&
-        static_cast<unsigned char>(s[1]) == 0xBB &&
-        static_cast<unsigned char>(s[2]) == 0xBF) {
-        s.erase(0, 3);
-    }
+enum class Mode {
+    TZ,       // РЕЖИМ 1: раскрываем "..." и <...> по include_directories
+    Flatten,  // РЕЖИМ 2: раскрываем только "...", а <...> оставляем как есть
+};
+
+// Настройки прогона
+struct RunOptions {
+    // Потоков для параллельной предзагрузки дерева include (0 — по числу ядер,
+    // 1 — без неё, всё читается по ходу последовательного обхода)
+    unsigned jobs = 1;
+
+    // > 0 — собрать в RunStats::slowest_files столько самых дорогих файлов
+    // (чтение + разбор). 0 — не собирать: остальные счётчики считаются всегда и почти даром.
+    std::size_t top_files = 0;
+
+    // Условная компиляция (v2_conditional.h): include в заведомо неактивных
+    // ветках #if/#ifdef/... не раскрываются, строка остаётся в выводе как есть.
+    // defines — как аргументы -D: "ИМЯ" или "ИМЯ=значение".
+    bool conditional = false;
+    std::vector<std::string> defines;
+
+    // Вывод через MinifySink (v2_minify.h): без комментариев, отступов и пустых строк
+    bool minify = false;
+
+    // flatten: #include <...> — один раз в начале вывода (v2_hoist.h). Если
+    // system_header задан — пролог пишется туда, а вывод начинается с
+    // #include "<имя файла system_header>" (заголовок кладут рядом с выводом).
+    bool hoist_system = false;
+    fs::path system_header;
+
+    // flatten: include, замыкающий цикл, пропустить (с предупреждением в log) и
+    // продолжить. По умолчанию цикл — ошибка: цепочка печатается, прогон не удаётся.
+    bool break_cycles = false;
+};
+
+struct SlowFile {
+    fs::path path;
+    std::uint64_t ns = 0;  // чтение + разбор
+};
+
+// Счётчики одного прогона
+struct RunStats {
+    FileCacheStats files;  // сколько файлов прочитано с диска и сколько проиграно из кэша
+    ResolverStats resolver;  // поиск include: кэш, отрицательный кэш, обращения к ФС
+    OutputStats output;      // запись результата: writev и копирование в ядре
+    std::size_t once_skipped = 0;      // flatten: пропущено повторных include (pragma once / guard)
+    std::size_t once_bytes_saved = 0;  // flatten: столько байт эти include дали бы в выходе
+    std::size_t max_depth = 0;         // самая длинная цепочка include (входной файл — 1)
+    std::size_t inactive_includes = 0;  // conditional: include в неактивных ветках, не раскрыты
+    std::uint64_t inactive_bytes = 0;   // conditional: размер этих файлов (без их собственных include)
+    std::uint64_t minify_bytes_in = 0;  // minify: байт до минификации (после — output.bytes)
+    std::size_t hoisted_includes = 0;   // hoist_system: строк <...> убрано из тела
+    std::size_t system_includes = 0;    // hoist_system: из них разных — столько в прологе
+    std::size_t cycles_broken = 0;      // break_cycles: пропущено include, замыкавших цикл
+    std::vector<SlowFile> slowest_files;  // RunOptions::top_files, по убыванию ns
+};
+
+// Кэши, которые можно переиспользовать между прогонами и делить между потоками:
+// разобранные файлы и поиск include (для одного набора include_directories).
+// files — откуда читать (диск или память); провайдер должен пережить кэши.
+struct SharedCaches {
+    explicit SharedCaches(std::vector<fs::path> include_directories, FileProvider& files = DiskFiles())
+        : provider(files), files(files), resolver(std::move(include_directories), files) {}
+
+    FileProvider& provider;
+    FileCache files;
+    IncludeResolver resolver;
+};
+
+namespace detail {
+
+// Держит в slowest не больше limit самых дорогих файлов, по убыванию
+inline void RecordSlowFile(std::vector<SlowFile>& slowest, const fs::path& path, std::uint64_t ns, std::size_t limit) {
+    if (slowest.size() == limit && slowest.back().ns >= ns) return;
+    auto pos = std::find_if(slowest.begin(), slowest.end(), [&](const SlowFile& f) { return f.ns < ns; });
+    slowest.insert(pos, SlowFile{path, ns});
+    if (slowest.size() > limit) slowest.pop_back();
 }
 
-inline void RStripCR(std::string& s) {
-    if (!s.empty() && s.back() == '\r') s.pop_back();
+// Конец вывода. Неудачная склейка прежний файл не трогает; ТЗ и при ошибке
+// оставляет всё, что успело записаться до неё (так в задании).
+inline bool FinishOutput(OutputSink& out, bool ok, Mode mode) {
+    if (ok || mode == Mode::TZ) return out.Close();
+    out.Discard();
+    return false;
 }
 
-inline fs::path Normalize(const fs::path& p) {
-    return p.lexically_normal();
-}
+// Общий движок обоих режимов: файлы читаются через FileCache (каждый — один раз),
+// include ищет IncludeResolver (индекс каталогов + кэш, включая "не найдено").
+// Сообщения "unknown include file ..." пишутся в log. Входные файлы уже проверены.
+// Несколько входных файлов идут в out подряд, как один unity-файл: include-once
+// общий, заголовок, вставленный для первого, для следующих пропускается.
+// hoisted не nullptr — поднимаемые <...> собираются туда, а не в out.
+inline bool ExpandUnitsInto(const std::vector<fs::path>& in_files,
+                            OutputSink& out,
+                            Mode mode,
+                            const RunOptions& options,
+                            SharedCaches& caches,
+                            RunStats& stats,
+                            std::ostream& log,
+                            SystemIncludes* hoisted = nullptr) {
+    if (options.minify) {
+        MinifySink minified(out);
+        RunOptions plain = options;
+        plain.minify = false;
+        const bool ok = ExpandUnitsInto(in_files, minified, mode, plain, caches, stats, log);
+        stats.minify_bytes_in += minified.BytesIn();
+        return ok;
+    }
 
-// =======================
-// РЕЖИМ 1 (ТЗ): раскрываем "..." и <...> по include_directories
-// + улучшения: BOM/CRLF, normalize, кэш
-// =======================
+    if (options.hoist_system && mode == Mode::Flatten && !hoisted) {
+        // пролог известен только в конце обхода: тело пока откладываем
+        SystemIncludes includes;
+        DeferredSink body;
+        const bool ok = ExpandUnitsInto(in_files, body, mode, options, caches, stats, log, &includes);
+        stats.system_includes += includes.Lines().size();
+
+        bool header_ok = true;
+        std::string include_header;  // живёт до out.Close()
+        if (options.system_header.empty()) {
+            includes.WriteTo(out);
+        } else {
+            header_ok = includes.WriteHeader(options.system_header);
+            include_header = "#include \"" + options.system_header.filename().generic_string() + "\"\n";
+            out.WriteText(include_header);
+        }
+        body.Replay(out);
+        const bool written = FinishOutput(out, ok, mode);
+        stats.output += out.Stats();
+        return ok && header_ok && written;
+    }
 
-inline bool Preprocess_TZ(const fs::path& in_file,
-                          const fs::path& out_file,
-                          const std::vector<fs::path>& include_directories) {
-    std::ifstream probe(in_file);
-    if (!probe.is_open()) return false;
+    // предзагрузка не знает макросов и прочла бы и неактивные ветки
+    if (options.jobs != 1 && !options.conditional) {
+        const unsigned threads = options.jobs ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+        for (const fs::path& in_file : in_files) {
+            const PrefetchStats prefetch = PrefetchIncludeTree(in_file, mode == Mode::TZ, caches.files,
+                                                               caches.resolver, threads);
+            stats.files += prefetch.files;
+            stats.resolver += prefetch.resolver;
+        }
+    }
 
-    std::ofstream out(out_file);
-    if (!out.is_open()) return false;
+    // flatten: identity include-once файла -> сколько байт дала его первая вставка
+    std::unordered_map<std::string, std::size_t> once_emitted;
+    std::size_t bytes_out = 0;
+    auto out_size = [](std::string_view text) {
+        return text.size() + (text.empty() || text.back() == '\n' ? 0 : 1);
+    };
+    auto emit = [&](std::string_view text) {
+        out.WriteText(text);
+        bytes_out += out_size(text);
+    };
 
-    const std::regex re_quote(R"inc(\s*#\s*include\s*"([^"]*)"\s*)inc", std::regex_constants::optimize);
-    const std::regex re_angle(R"inc(\s*#\s*include\s*<([^>]*)>\s*)inc", std::regex_constants::optimize);
+    // Активные файлы — явный стек курсоров (файл + номер следующего сегмента),
+    // без рекурсии: глубина цепочки include ограничена только памятью под Frame.
+    struct Frame {
+        const fs::path* path;
+        const ParsedFile* file;
+        std::size_t next = 0;         // следующий сегмент
+        std::size_t start_bytes = 0;  // flatten: bytes_out при входе (для include-once)
+        bool once = false;
+        std::uint32_t dir_id = IncludeResolver::kNoDir;  // каталог файла — при первом "..."
+        std::size_t next_cond = 0;   // conditional: следующая директива #if/#define/...
+        std::size_t cond_depth = 0;  // conditional: глубина #if при входе в файл
+        bool hoistable = false;      // hoisted: файл подключён вне #if — его <...> можно поднять
+        detail::IfDepth if_depth;    // hoisted: глубина #if внутри файла
+    };
+    std::vector<Frame> stack;
+    // identity файлов на стеке -> номер кадра: повторный вход в такой файл — цикл, он не кончится
+    std::unordered_map<std::string, std::size_t> on_stack;
+    std::unordered_set<const ParsedFile*> seen;  // top_files: каждый файл учитывается один раз
+
+    std::optional<Conditions> conditions;
+    if (options.conditional) conditions.emplace(options.defines);
+    // Применяет директивы условной компиляции файла, стоящие до upto (nullptr — все)
+    auto apply_conditions = [&](Frame& frame, const char* upto) {
+        const std::vector<CondDirective>& list = frame.file->conditionals;
+        for (; frame.next_cond < list.size(); ++frame.next_cond) {
+            if (upto && list[frame.next_cond].text.data() >= upto) break;
+            conditions->Apply(list[frame.next_cond]);
+        }
+    };
 
-    std::unordered_map<std::string, fs::path> cache;
+    // Цепочка от кадра first до вершины: где какой include стоит
+    auto cycle_chain = [&](std::size_t first) {
+        std::vector<common::IncludeEdge> chain;
+        for (std::size_t i = first; i < stack.size(); ++i) {
+            chain.push_back({stack[i].path->generic_string(), stack[i].file->segments[stack[i].next - 1].line_no});
+        }
+        return chain;
+    };
 
-    std::function<bool(const fs::path&, int)> expand = [&](const fs::path& current, int depth) -> bool {
-        if (depth > 200) {
-            std::cout << "unknown include file TOO_DEEP at file " << current.string()
-                      << " at line 1\n";
+    // false — файл не открылся или зациклился; true — файл на стеке или пропущен (include-once, break_cycles)
+    auto enter = [&](const fs::path& path, bool hoistable) -> bool {
+        const ParsedFile* file = caches.files.Load(path, &stats.files);
+        if (!file) return false;
+
+        const bool once = mode == Mode::Flatten && file->include_once;
+        if (once) {
+            if (auto it = once_emitted.find(file->identity); it != once_emitted.end()) {
+                ++stats.once_skipped;
+                stats.once_bytes_saved += it->second;
+                return true;
+            }
+            once_emitted.emplace(file->identity, 0);
+        }
+        if (auto it = on_stack.find(file->identity); it != on_stack.end()) {
+            if (options.break_cycles && mode == Mode::Flatten) {
+                common::WriteIncludeCycle(log, cycle_chain(it->second), path.generic_string(), "include cycle skipped");
+                ++stats.cycles_broken;
+                return true;
+            }
+            common::WriteIncludeCycle(log, cycle_chain(it->second), path.generic_string());
             return false;
         }
+        on_stack.emplace(file->identity, stack.size());
+        hoistable = hoistable && hoisted;
+        stack.push_back({&path, file, 0, bytes_out, once, IncludeResolver::kNoDir, 0,
+                         conditions ? conditions->Depth() : 0, hoistable,
+                         detail::IfDepth{0, 0, hoistable && detail::HasIncludeGuard(*file)}});
+        stats.max_depth = std::max(stats.max_depth, stack.size());
+        if (options.top_files > 0 && seen.insert(file).second) {
+            detail::RecordSlowFile(stats.slowest_files, path, file->read_ns + file->scan_ns, options.top_files);
+        }
+        return true;
+    };
 
-        std::ifstream in(current);
-        if (!in.is_open()) return false;
-
-        std::string line;
-        std::size_t line_no = 0;
-
-        while (std::getline(in, line)) {
-            ++line_no;
-            if (line_no == 1) StripUtf8BOM(line);
-            RStripCR(line);
-
-            std::smatch m;
-
-            // "..."
-            if (std::regex_match(line, m, re_quote)) {
-                const std::string token = m[1].str();
-                const fs::path rel(token);
-                const fs::path here = current.parent_path();
-
-                const std::string key = std::string("Q|") + here.string() + "|" + token;
-                if (auto it = cache.find(key); it != cache.end()) {
-                    if (!expand(it->second, depth + 1)) return false;
-                    continue;
-                }
-
-                std::vector<fs::path> candidates;
-                candidates.push_back(Normalize(here / rel));
-                for (const auto& dir : include_directories) candidates.push_back(Normalize(dir / rel));
-
-                bool ok = false;
-                for (const auto& cand : candidates) {
-                    std::ifstream test(cand);
-                    if (test.is_open()) {
-                        cache[key] = cand;
-                        if (!expand(cand, depth + 1)) return false;
-                        ok = true;
-                        break;
-                    }
+    auto drain = [&]() -> bool {
+        while (!stack.empty()) {
+            Frame& top = stack.back();
+            if (top.next == top.file->segments.size()) {
+                if (conditions) {
+                    // #define после последнего include действуют и в следующих файлах
+                    apply_conditions(top, nullptr);
+                    conditions->Truncate(top.cond_depth);
                 }
-
-                if (!ok) {
-                    std::cout << "unknown include file " << token
-                              << " at file " << current.string()
-                              << " at line " << line_no << "\n";
-                    return false;
+                if (top.once) once_emitted[top.file->identity] = bytes_out - top.start_bytes;
+                on_stack.erase(top.file->identity);
+                stack.pop_back();
+                continue;
+            }
+            const ParsedFile* file = top.file;
+            const fs::path& current = *top.path;
+            const Segment& seg = file->segments[top.next++];
+
+            if (seg.kind == SegmentKind::Text) {
+                if (file->normalized.empty() && !file->source.IsBorrowed()) {
+                    // сегмент — нетронутый кусок файла на диске: его можно копировать прямо из файла
+                    const std::string_view whole = file->source.View();
+                    out.WriteTextFromFile(seg.text, current, static_cast<std::uint64_t>(seg.text.data() - whole.data()),
+                                         file->stamp);
+                    bytes_out += out_size(seg.text);
+                } else {
+                    emit(seg.text);
                 }
                 continue;
             }
 
-            // <...> (ТЗ-режим: ищем по include_directories)
-            if (std::regex_match(line, m, re_angle)) {
-                const std::string token = m[1].str();
-                const fs::path rel(token);
+            if (seg.kind == SegmentKind::PragmaOnce) {
+                // при flatten убираем (чтобы не было warning в итоговом .cpp)
+                if (mode == Mode::TZ) emit(seg.text);
+                continue;
+            }
 
-                const std::string key = std::string("A|") + token;
-                if (auto it = cache.find(key); it != cache.end()) {
-                    if (!expand(it->second, depth + 1)) return false;
-                    continue;
+            // <...> при flatten НЕ раскрываем — оставляем компилятору
+            if (seg.kind == SegmentKind::IncludeAngle && mode == Mode::Flatten) {
+                if (top.hoistable && top.if_depth.At(*file, seg.text.data()) == 0) {
+                    hoisted->Add(seg.token, seg.text);
+                    ++stats.hoisted_includes;
+                } else {
+                    emit(seg.text);
                 }
+                continue;
+            }
 
-                bool ok = false;
-                for (const auto& dir : include_directories) {
-                    fs::path cand = Normalize(dir / rel);
-                    std::ifstream test(cand);
-                    if (test.is_open()) {
-                        cache[key] = cand;
-                        if (!expand(cand, depth + 1)) return false;
-                        ok = true;
-                        break;
+            const bool quoted = seg.kind == SegmentKind::IncludeQuote;
+            if (quoted && top.dir_id == IncludeResolver::kNoDir) top.dir_id = caches.resolver.DirId(current.parent_path());
+
+            if (conditions) {
+                apply_conditions(top, seg.text.data());
+                if (!conditions->Active()) {
+                    // компилятор эту строку всё равно пропустит
+                    emit(seg.text);
+                    ++stats.inactive_includes;
+                    if (const fs::path* skipped = caches.resolver.Resolve(top.dir_id, seg.token, quoted, &stats.resolver)) {
+                        stats.inactive_bytes += caches.provider.Stamp(*skipped).size;
                     }
+                    continue;
                 }
+            }
 
-                if (!ok) {
-                    std::cout << "unknown include file " << token
-                              << " at file " << current.string()
-                              << " at line " << line_no << "\n";
-                    return false;
-                }
+            const fs::path* target = caches.resolver.Resolve(top.dir_id, seg.token, quoted, &stats.resolver);
+            if (target) {
+                const bool hoistable = top.hoistable && top.if_depth.At(*file, seg.text.data()) == 0;
+                // top после enter() недействителен (push_back)
+                if (!enter(*target, hoistable)) return false;
                 continue;
             }
 
-            out << line << '\n';
+            if (mode == Mode::TZ) {
+                log << "unknown include file " << seg.token
+                    << " at file " << current.string()
+                    << " at line " << seg.line_no << "\n";
+            }
+            return false;
         }
+        return true;
+    };
 
+    auto expand = [&]() -> bool {
+        for (const fs::path& in_file : in_files) {
+            if (!enter(in_file, true) || !drain()) return false;
+        }
         return true;
     };
 
-    return expand(in_file, 0);
+    const bool ok = expand();
+    const bool written = FinishOutput(out, ok, mode);
+    stats.output += out.Stats();
+    return ok && written;
 }
 
-inline bool Preprocess(const fs::path& in_file,
-                       const fs::path& out_file,
-                       const std::vector<fs::path>& include_directories) {
-    return Preprocess_TZ(in_file, out_file, include_directories);
+inline bool ExpandInto(const fs::path& in_file,
+                       OutputSink& out,
+                       Mode mode,
+                       const RunOptions& options,
+                       SharedCaches& caches,
+                       RunStats& stats,
+                       std::ostream& log) {
+    return ExpandUnitsInto({in_file}, out, mode, options, caches, stats, log);
 }
 
-// =======================
-// РЕЖИМ 2 (FLATTEN): раскрываем только "..." , а <...> оставляем как есть
-// + улучшения: BOM/CRLF, normalize, кэш
-// =======================
-
-inline bool FlattenProject(const fs::path& in_file,
-                           const fs::path& out_file,
-                           const std::vector<fs::path>& include_directories) {
-    std::ifstream probe(in_file);
-    if (!probe.is_open()) return false;
+// Вход не открылся — приёмник не трогаем
+inline bool ExpandProject(const fs::path& in_file,
+                          OutputSink& out,
+                          Mode mode,
+                          const RunOptions& options,
+                          SharedCaches& caches,
+                          RunStats& stats,
+                          std::ostream& log) {
+    if (!caches.provider.CanOpen(in_file)) return false;
+    return ExpandInto(in_file, out, mode, options, caches, stats, log);
+}
 
-    std::ofstream out(out_file);
-    if (!out.is_open()) return false;
+// Вход не открылся — выходной файл не создаётся
+inline bool ExpandProject(const fs::path& in_file,
+                          const fs::path& out_file,
+                          Mode mode,
+                          const RunOptions& options,
+                          SharedCaches& caches,
+                          RunStats& stats,
+                          std::ostream& log) {
+    if (!caches.provider.CanOpen(in_file)) return false;
+
+    OutputWriter out;
+    if (!out.Open(out_file)) return false;
+    return ExpandInto(in_file, out, mode, options, caches, stats, log);
+}
 
-    const std::regex re_quote(R"inc(\s*#\s*include\s*"([^"]*)"\s*)inc", std::regex_constants::optimize);
-    const std::regex re_angle(R"inc(\s*#\s*include\s*<([^>]*)>\s*)inc", std::regex_constants::optimize);
+} // namespace detail
 
-    std::unordered_map<std::string, fs::path> cache;
+// =======================
+// РЕЖИМ 1 (ТЗ): раскрываем "..." и <...> по include_directories
+// + улучшения: BOM/CRLF, normalize, кэш
+// =======================
 
-    std::function<bool(const fs::path&, int)> expand = [&](const fs::path& current, int depth) -> bool {
-        if (depth > 200) return false;
+inline bool Preprocess_TZ(const fs::path& in_file,
+                          const fs::path& out_file,
+                          const std::vector<fs::path>& include_directories,
+                          const RunOptions& options,
+                          RunStats& stats) {
+    SharedCaches caches(include_directories);
+    return detail::ExpandProject(in_file, out_file, Mode::TZ, options, caches, stats, std::cout);
+}
 
-        std::ifstream in(current);
-        if (!in.is_open()) return false;
+inline bool Preprocess_TZ(const fs::path& in_file,
+                          const fs::path& out_file,
+                          const std::vector<fs::path>& include_directories,
+                          RunStats& stats) {
+    return Preprocess_TZ(in_file, out_file, include_directories, RunOptions{}, stats);
+}
 
-        std::string line;
-        std::size_t line_no = 0;
+inline bool Preprocess_TZ(const fs::path& in_file,
+                          const fs::path& out_file,
+                          const std::vector<fs::path>& include_directories) {
+    RunStats stats;
+    return Preprocess_TZ(in_file, out_file, include_directories, stats);
+}
 
-        while (std::getline(in, line)) {
-            ++line_no;
-            if (line_no == 1) StripUtf8BOM(line);
-            RStripCR(line);
+inline bool Preprocess(const fs::path& in_file,
+                       const fs::path& out_file,
+                       const std::vector<fs::path>& include_directories) {
+    return Preprocess_TZ(in_file, out_file, include_directories);
+}
 
-            std::smatch m;
+// То же без диска: файлы берутся из files, результат уходит в out.
+// Вывод побайтно совпадает с выводом в файл при том же содержимом файлов.
+inline bool Preprocess_TZ(const fs::path& in_file,
+                          OutputSink& out,
+                          const std::vector<fs::path>& include_directories,
+                          FileProvider& files,
+                          const RunOptions& options,
+                          RunStats& stats) {
+    SharedCaches caches(include_directories, files);
+    return detail::ExpandProject(in_file, out, Mode::TZ, options, caches, stats, std::cout);
+}
 
-            // "..."
-            if (std::regex_match(line, m, re_quote)) {
-                const std::string token = m[1].str();
-                const fs::path rel(token);
-                const fs::path here = current.parent_path();
+inline bool Preprocess(const fs::path& in_file,
+                       OutputSink& out,
+                       const std::vector<fs::path>& include_directories,
+                       FileProvider& files = DiskFiles()) {
+    RunStats stats;
+    return Preprocess_TZ(in_file, out, include_directories, files, RunOptions{}, stats);
+}
 
-                const std::string key = std::string("Q|") + here.string() + "|" + token;
-                if (auto it = cache.find(key); it != cache.end()) {
-                    if (!expand(it->second, depth + 1)) return false;
-                    continue;
-                }
+// =======================
+// РЕЖИМ 2 (FLATTEN): раскрываем только "..." , а <...> оставляем как есть
+// + улучшения: BOM/CRLF, normalize, кэш
+// =======================
 
-                std::vector<fs::path> candidates;
-                candidates.push_back(Normalize(here / rel));
-                for (const auto& dir : include_directories) candidates.push_back(Normalize(dir / rel));
-
-                bool ok = false;
-                for (const auto& cand : candidates) {
-                    std::ifstream test(cand);
-                    if (test.is_open()) {
-                        cache[key] = cand;
-                        if (!expand(cand, depth + 1)) return false;
-                        ok = true;
-                        break;
-                    }
-                }
-                if (!ok) return false;
-                continue;
-            }
+inline bool FlattenProject(const fs::path& in_file,
+                           const fs::path& out_file,
+                           const std::vector<fs::path>& include_directories,
+                           const RunOptions& options,
+                           RunStats& stats) {
+    SharedCaches caches(include_directories);
+    return detail::ExpandProject(in_file, out_file, Mode::Flatten, options, caches, stats, std::cout);
+}
 
-            // <...> НЕ раскрываем — оставляем компилятору
-            if (std::regex_match(line, m, re_angle)) {
-                out << line << '\n';
-                continue;
-            }
+inline bool FlattenProject(const fs::path& in_file,
+                           const fs::path& out_file,
+                           const std::vector<fs::path>& include_directories,
+                           RunStats& stats) {
+    return FlattenProject(in_file, out_file, include_directories, RunOptions{}, stats);
+}
 
-            out << line << '\n';
-        }
+inline bool FlattenProject(const fs::path& in_file,
+                           const fs::path& out_file,
+                           const std::vector<fs::path>& include_directories) {
+    RunStats stats;
+    return FlattenProject(in_file, out_file, include_directories, stats);
+}
 
-        return true;
-    };
+inline bool FlattenProject(const fs::path& in_file,
+                           OutputSink& out,
+                           const std::vector<fs::path>& include_directories,
+                           FileProvider& files,
+                           const RunOptions& options,
+                           RunStats& stats) {
+    SharedCaches caches(include_directories, files);
+    return detail::ExpandProject(in_file, out, Mode::Flatten, options, caches, stats, std::cout);
+}
 
-    return expand(in_file, 0);
+inline bool FlattenProject(const fs::path& in_file,
+                           OutputSink& out,
+                           const std::vector<fs::path>& include_directories,
+                           FileProvider& files = DiskFiles()) {
+    RunStats stats;
+    return FlattenProject(in_file, out, include_directories, files, RunOptions{}, stats);
 }
 
 } // namespace v2
@@ -0,0 +1,322 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "v2_intern.h"
+#include "v2_vfs.h"
+
+namespace v2 {
+namespace fs = std::filesystem;
+
+// =======================
+// Поиск include: каталоги include_directories обходятся один раз и
+// индексируются, результаты (в том числе "не найдено") кэшируются
+// =======================
+
+inline fs::path Normalize(const fs::path& p) {
+    return p.lexically_normal();
+}
+
+// Windows и macOS: ФС обычно не различает регистр, и "Foo.h" находит foo.h.
+// Индекс знает только точные имена — промах в нём там не окончателен.
+#if defined(_WIN32) || defined(__APPLE__)
+inline constexpr bool kCaseSensitiveFs = false;
+#else
+inline constexpr bool kCaseSensitiveFs = true;
+#endif
+
+struct ResolverStats {
+    std::size_t lookups = 0;        // всего запросов Resolve
+    std::size_t cache_hits = 0;     // ответ из кэша (найден)
+    std::size_t negative_hits = 0;  // ответ из кэша ("не найден")
+    std::size_t probes = 0;         // обращений к ФС (stat) при поиске
+    std::size_t dirs_indexed = 0;   // каталогов include_directories проиндексировано
+    std::size_t files_indexed = 0;  // файлов в индексе
+    std::uint64_t probe_ns = 0;     // время промахов кэша: индекс каталогов и stat
+};
+
+inline ResolverStats& operator+=(ResolverStats& to, const ResolverStats& d) {
+    to.lookups += d.lookups;
+    to.cache_hits += d.cache_hits;
+    to.negative_hits += d.negative_hits;
+    to.probes += d.probes;
+    to.dirs_indexed += d.dirs_indexed;
+    to.files_indexed += d.files_indexed;
+    to.probe_ns += d.probe_ns;
+    return to;
+}
+
+// Сколько строк резолвер хранит в аренах (каталоги, токены, найденные пути)
+struct InternStats {
+    std::size_t dirs = 0;
+    std::size_t tokens = 0;
+    std::size_t paths = 0;
+    std::size_t arena_bytes = 0;
+};
+
+// Потокобезопасен: один резолвер можно делить между потоками (batch-режим).
+class IncludeResolver {
+public:
+    static constexpr std::uint32_t kNoDir = InternTable::kNone;
+
+    explicit IncludeResolver(std::vector<fs::path> include_directories, FileProvider& files = DiskFiles())
+        : include_directories_(std::move(include_directories)), files_(files) {}
+
+    // Номер каталога для Resolve(dir_id, ...): движок берёт его один раз на файл,
+    // а не собирает путь каталога на каждый include.
+    std::uint32_t DirId(const fs::path& dir) {
+        std::string buf;
+        const std::string_view view = PathString(dir, buf);
+        {
+            std::shared_lock lock(mutex_);
+            if (const std::uint32_t id = dirs_.Find(view); id != InternTable::kNone) return id;
+        }
+        std::unique_lock lock(mutex_);
+        return dirs_.Intern(view);
+    }
+
+    // Порядок как раньше: "..." — сначала папка текущего файла, затем
+    // include_directories по порядку; <...> — только include_directories.
+    // nullptr — файл не найден. run_stats (если задан) — счётчики конкретного прогона.
+    const fs::path* Resolve(const fs::path& here, std::string_view token, bool quoted,
+                            ResolverStats* run_stats = nullptr) {
+        return Resolve(quoted ? DirId(here) : kNoDir, token, quoted, run_stats);
+    }
+
+    // То же по номеру каталога. Попадание в кэш не выделяет память:
+    // каталог, токен и ответ ищутся по string_view и паре номеров.
+    const fs::path* Resolve(std::uint32_t here_id, std::string_view token, bool quoted,
+                            ResolverStats* run_stats = nullptr) {
+        ResolverStats delta;
+        ++delta.lookups;
+        if (!quoted) here_id = kNoDir;  // для <...> папка текущего файла не важна
+
+        {
+            std::shared_lock lock(mutex_);
+            const std::uint32_t token_id = tokens_.Find(token);
+            if (token_id != InternTable::kNone) {
+                if (auto it = cache_.find(CacheKey(here_id, token_id)); it != cache_.end()) {
+                    const std::uint32_t path_id = it->second;
+                    const fs::path* found = path_id == kNotFound ? nullptr : &paths_[path_id];
+                    lock.unlock();
+                    ++(found ? delta.cache_hits : delta.negative_hits);
+                    Count(delta, run_stats);
+                    return found;
+                }
+            }
+        }
+
+        const auto miss_start = std::chrono::steady_clock::now();
+        fs::path here;
+        if (quoted) {
+            std::shared_lock lock(mutex_);
+            here = fs::path(std::string(dirs_.View(here_id)));
+        }
+
+        std::optional<fs::path> found;
+        const fs::path rel{std::string(token)};
+        if (quoted) {
+            fs::path cand = Normalize(here / rel);
+            if (IsFile(cand, delta)) found = std::move(cand);
+        }
+        if (!found) found = FindInIncludeDirectories(rel, delta);
+
+        const fs::path* result = nullptr;
+        {
+            // если другой поток успел раньше — остаётся его (такой же) ответ
+            std::unique_lock lock(mutex_);
+            std::uint32_t path_id = kNotFound;
+            if (found) {
+                std::string buf;
+                const std::size_t before = path_ids_.Size();
+                path_id = path_ids_.Intern(PathString(*found, buf));
+                if (path_ids_.Size() != before) paths_.push_back(std::move(*found));
+            }
+            const std::uint32_t token_id = tokens_.Intern(token);
+            path_id = cache_.try_emplace(CacheKey(here_id, token_id), path_id).first->second;
+            if (path_id != kNotFound) result = &paths_[path_id];
+        }
+        delta.probe_ns = static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - miss_start).count());
+        Count(delta, run_stats);
+        return result;
+    }
+
+    // Для долгоживущего процесса: файлы на диске могли появиться/исчезнуть.
+    // Сбрасывает индекс каталогов и все закэшированные ответы. Указатели,
+    // выданные Resolve раньше, остаются действительными (пути не удаляются).
+    void Invalidate() {
+        std::unique_lock lock(mutex_);
+        cache_.clear();
+        index_.clear();
+        indexed_ = false;
+        has_dir_symlinks_ = false;
+        std::lock_guard watch_lock(watch_mutex_);
+        watched_.clear();
+    }
+
+    // То же, но только если что-то поменялось: сверяет версии всех каталогов,
+    // содержимое которых повлияло на ответы (индекс и проверенные кандидаты).
+    // Вызывать между прогонами. true — кэш сброшен.
+    bool Revalidate() {
+        {
+            std::lock_guard watch_lock(watch_mutex_);
+            bool changed = false;
+            for (const auto& [dir, stamp] : watched_) {
+                if (files_.Stamp(fs::path(dir)) != stamp) {
+                    changed = true;
+                    break;
+                }
+            }
+            if (!changed) return false;
+        }
+        Invalidate();
+        return true;
+    }
+
+    // Каталоги, от содержимого которых зависят ответы (для --watch: за ними и следить)
+    std::vector<fs::path> WatchedDirectories() const {
+        std::lock_guard watch_lock(watch_mutex_);
+        std::vector<fs::path> dirs;
+        dirs.reserve(watched_.size());
+        for (const auto& entry : watched_) dirs.emplace_back(entry.first);
+        return dirs;
+    }
+
+    InternStats Interned() const {
+        std::shared_lock lock(mutex_);
+        InternStats st;
+        st.dirs = dirs_.Size();
+        st.tokens = tokens_.Size();
+        st.paths = path_ids_.Size();
+        st.arena_bytes = dirs_.Storage().Bytes() + tokens_.Storage().Bytes() + path_ids_.Storage().Bytes();
+        return st;
+    }
+
+    ResolverStats Stats() const {
+        std::lock_guard lock(stats_mutex_);
+        return stats_;
+    }
+
+    const std::vector<fs::path>& IncludeDirectories() const { return include_directories_; }
+
+private:
+    static constexpr std::uint32_t kNotFound = InternTable::kNone;
+
+    static std::uint64_t CacheKey(std::uint32_t dir_id, std::uint32_t token_id) {
+        return (static_cast<std::uint64_t>(dir_id) << 32) | token_id;
+    }
+
+    bool IsFile(const fs::path& p, ResolverStats& delta) {
+        ++delta.probes;
+        Watch(p.parent_path());
+        return files_.IsFile(p);
+    }
+
+    // Запоминает версию каталога до того, как по нему отвечать
+    void Watch(const fs::path& dir) {
+        std::string buf;
+        const std::string& key = PathString(dir, buf);
+        std::lock_guard watch_lock(watch_mutex_);
+        if (watched_.count(key) == 0) watched_.emplace(key, files_.Stamp(dir));
+    }
+
+    // Ключ индекса — нормализованный относительный путь ("lib/std2.h").
+    // Пути с ".." вверх или абсолютные в индекс не попадают.
+    static std::optional<std::string> IndexKey(const fs::path& rel) {
+        if (rel.empty() || rel.is_absolute() || rel.has_root_name()) return std::nullopt;
+        const fs::path norm = Normalize(rel);
+        if (norm.empty() || *norm.begin() == "..") return std::nullopt;
+        return norm.generic_string();
+    }
+
+    // Вызывается под unique-блокировкой mutex_
+    void BuildIndex(ResolverStats& delta) {
+        indexed_ = true;
+        for (std::size_t i = 0; i < include_directories_.size(); ++i) {
+            const fs::path& dir = include_directories_[i];
+            Watch(dir);
+            bool complete = true;
+            const bool listed = files_.ListFiles(dir, [&](const fs::path& rel, bool is_dir) {
+                if (is_dir) {
+                    Watch(dir / rel);
+                    return;
+                }
+                // emplace не перезаписывает: побеждает первый каталог по порядку
+                if (index_.emplace(rel.generic_string(), i).second) ++delta.files_indexed;
+            }, complete);
+            if (!listed) continue;
+            ++delta.dirs_indexed;
+            if (!complete) has_dir_symlinks_ = true;
+        }
+    }
+
+    std::optional<fs::path> FindInIncludeDirectories(const fs::path& rel, ResolverStats& delta) {
+        if (const std::optional<std::string> key = IndexKey(rel)) {
+            std::optional<std::size_t> dir_index;
+            bool incomplete = false;
+            {
+                std::shared_lock lock(mutex_);
+                if (indexed_) {
+                    if (auto it = index_.find(*key); it != index_.end()) dir_index = it->second;
+                    incomplete = has_dir_symlinks_;
+                }
+            }
+            if (!dir_index && !incomplete) {
+                std::unique_lock lock(mutex_);
+                if (!indexed_) BuildIndex(delta);
+                if (auto it = index_.find(*key); it != index_.end()) dir_index = it->second;
+                incomplete = has_dir_symlinks_;
+            }
+            if (dir_index) return Normalize(include_directories_[*dir_index] / rel);
+            if (!incomplete && kCaseSensitiveFs) return std::nullopt;
+        }
+
+        // "../x.h", абсолютные пути, симлинки на каталоги, регистр на ФС без
+        // его учёта — проверяем по-старому, каталог за каталогом
+        for (const auto& dir : include_directories_) {
+            fs::path cand = Normalize(dir / rel);
+            if (IsFile(cand, delta)) return cand;
+        }
+        return std::nullopt;
+    }
+
+    void Count(const ResolverStats& delta, ResolverStats* run_stats) {
+        if (run_stats) *run_stats += delta;
+        std::lock_guard lock(stats_mutex_);
+        stats_ += delta;
+    }
+
+    const std::vector<fs::path> include_directories_;
+    FileProvider& files_;
+
+    mutable std::shared_mutex mutex_;  // всё ниже, кроме счётчиков
+    InternTable dirs_;      // каталоги текущих файлов
+    InternTable tokens_;    // то, что написано в include
+    InternTable path_ids_;  // найденные пути; номер — индекс в paths_
+    std::deque<fs::path> paths_;  // deque: адреса не меняются при добавлении
+    std::unordered_map<std::uint64_t, std::uint32_t> cache_;  // (dir_id, token_id) -> номер пути или kNotFound
+    std::unordered_map<std::string, std::size_t> index_;  // относительный путь -> номер каталога
+    bool indexed_ = false;
+    bool has_dir_symlinks_ = false;
+
+    mutable std::mutex watch_mutex_;  // после mutex_, если нужны оба
+    std::unordered_map<std::string, FileStamp> watched_;  // каталог -> версия, когда на него посмотрели
+
+    mutable std::mutex stats_mutex_;
+    ResolverStats stats_;
+};
+
+} // namespace v2
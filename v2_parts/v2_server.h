@@ -0,0 +1,86 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <string>
+
+#include "v2_preprocess_impl.h"
+#include "v2_stats.h"
+
+namespace v2 {
+namespace fs = std::filesystem;
+
+// =======================
+// SERVE: долгоживущий процесс для редакторов и систем сборки — кэши
+// остаются тёплыми между запросами, перед каждым запросом сверяются с диском
+// =======================
+//
+// Протокол — строки через stdin/stdout (сокет, если нужен, — socat/ssh снаружи):
+//   tz <in_file> <out_file>        как v2.exe <in> <out> <include_dir...>
+//   flatten <in_file> <out_file>   как v2.exe --flatten <in> <out> <include_dir...>
+//   quit                           завершить
+// Пустые строки и строки с '#' в начале пропускаются. На каждый запрос —
+// ровно то, что одиночный запуск напечатал бы в stdout после приветствия,
+// и строка "= <код выхода> <ms> ms" (задержка запроса вместе со сверкой кэшей).
+
+struct ServeReport {
+    std::size_t requests = 0;
+    std::size_t failed = 0;        // код выхода не 0
+    std::size_t files_dropped = 0;  // файлов выброшено из кэша при сверке
+    std::size_t resolver_resets = 0;  // сколько раз кэш поиска include сбрасывался
+};
+
+namespace detail {
+
+// Код выхода как у одиночного запуска: 0 — успех, 1 — ошибка, 2 — неверный запрос
+inline int ServeOne(const std::string& line, std::ostream& out, const RunOptions& options,
+                    SharedCaches& caches, ServeReport& report) {
+    std::istringstream fields(line);
+    std::string command, in_file, out_file, extra;
+    fields >> command >> in_file >> out_file;
+    if ((command != "tz" && command != "flatten") || out_file.empty() || (fields >> extra)) {
+        out << "bad request: " << line << "\n";
+        return 2;
+    }
+
+    report.files_dropped += caches.files.Revalidate();
+    if (caches.resolver.Revalidate()) ++report.resolver_resets;
+
+    const Mode mode = command == "tz" ? Mode::TZ : Mode::Flatten;
+    RunStats stats;
+    const bool ok = ExpandProject(fs::path(in_file), fs::path(out_file), mode, options, caches, stats, out);
+    if (ok && mode == Mode::Flatten) WriteOnceSummary(out, stats);
+    return ok ? 0 : 1;
+}
+
+} // namespace detail
+
+// Обслуживает запросы из in, пока он не кончится или не придёт quit.
+// caches — общие на всю сессию (include_directories задаются при запуске).
+inline ServeReport Serve(std::istream& in, std::ostream& out, SharedCaches& caches,
+                         const RunOptions& options = RunOptions{}) {
+    using Clock = std::chrono::steady_clock;
+    ServeReport report;
+    std::string line;
+    while (std::getline(in, line)) {
+        RStripCR(line);
+        const std::size_t first = line.find_first_not_of(" \t");
+        if (first == std::string::npos || line[first] == '#') continue;
+        if (line.compare(first, std::string::npos, "quit") == 0) break;
+
+        const auto start = Clock::now();
+        const int code = detail::ServeOne(line, out, options, caches, report);
+        const double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        ++report.requests;
+        if (code != 0) ++report.failed;
+        out << "= " << code << " " << ms << " ms\n";
+        out.flush();  // клиент ждёт ответа до следующего запроса
+    }
+    return report;
+}
+
+} // namespace v2
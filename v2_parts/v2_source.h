@@ -0,0 +1,392 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define V2_HAVE_MMAP 1
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define V2_HAVE_SSE2 1
+#endif
+
+namespace v2 {
+namespace fs = std::filesystem;
+
+// =======================
+// Входной слой: файл целиком в памяти (mmap или один read), строки — string_view
+// =======================
+
+inline void StripUtf8BOM(std::string& s) {
+    if (s.size() >= 3 &&
+        static_cast<unsigned char>(s[0]) == 0xEF &&
+        static_cast<unsigned char>(s[1]) == 0xBB &&
+        static_cast<unsigned char>(s[2]) == 0xBF) {
+        s.erase(0, 3);
+    }
+}
+
+inline void StripUtf8BOM(std::string_view& s) {
+    if (s.size() >= 3 &&
+        static_cast<unsigned char>(s[0]) == 0xEF &&
+        static_cast<unsigned char>(s[1]) == 0xBB &&
+        static_cast<unsigned char>(s[2]) == 0xBF) {
+        s.remove_prefix(3);
+    }
+}
+
+inline void RStripCR(std::string& s) {
+    if (!s.empty() && s.back() == '\r') s.pop_back();
+}
+
+inline void RStripCR(std::string_view& s) {
+    if (!s.empty() && s.back() == '\r') s.remove_suffix(1);
+}
+
+// Содержимое файла. Где есть mmap — отображение файла без копирования,
+// иначе (Windows/MinGW) — один bulk read в std::string. Borrow — чужой буфер
+// (файл из памяти, см. v2_vfs.h), тоже без копирования.
+class SourceBuffer {
+public:
+    SourceBuffer() = default;
+    SourceBuffer(const SourceBuffer&) = delete;
+    SourceBuffer& operator=(const SourceBuffer&) = delete;
+
+    SourceBuffer(SourceBuffer&& other) noexcept { *this = std::move(other); }
+    SourceBuffer& operator=(SourceBuffer&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+            mapped_ = std::exchange(other.mapped_, false);
+            borrowed_ = std::exchange(other.borrowed_, false);
+            storage_ = std::move(other.storage_);
+            if (!mapped_ && !borrowed_) data_ = storage_.data();
+        }
+        return *this;
+    }
+
+    ~SourceBuffer() { Reset(); }
+
+    // false — файл не открылся (как !ifstream::is_open())
+    bool Open(const fs::path& file) {
+        Reset();
+#ifdef V2_HAVE_MMAP
+        const int fd = ::open(file.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st {};
+        if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            ::close(fd);
+            return ReadAll(file);
+        }
+        if (st.st_size == 0) {
+            ::close(fd);
+            return true;
+        }
+        if (static_cast<std::size_t>(st.st_size) < kMapMin) {
+            // маленький файл: mmap + munmap дороже одного read
+            const bool ok = ReadSmall(fd, static_cast<std::size_t>(st.st_size));
+            ::close(fd);
+            return ok || ReadAll(file);
+        }
+        void* addr = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) return ReadAll(file);
+#ifdef MADV_SEQUENTIAL
+        ::madvise(addr, static_cast<std::size_t>(st.st_size), MADV_SEQUENTIAL);
+#endif
+        data_ = static_cast<const char*>(addr);
+        size_ = static_cast<std::size_t>(st.st_size);
+        mapped_ = true;
+        return true;
+#else
+        return ReadAll(file);
+#endif
+    }
+
+    // text должен жить дольше буфера
+    void Borrow(std::string_view text) {
+        Reset();
+        data_ = text.data();
+        size_ = text.size();
+        borrowed_ = true;
+    }
+
+    std::string_view View() const { return {data_ ? data_ : "", size_}; }
+    bool IsMapped() const { return mapped_; }
+    bool IsBorrowed() const { return borrowed_; }
+
+private:
+#ifdef V2_HAVE_MMAP
+    // Файлы меньше этого читаются read(), а не отображаются
+    static constexpr std::size_t kMapMin = 64 * 1024;
+
+    bool ReadSmall(int fd, std::size_t size) {
+        storage_.resize(size);
+        std::size_t done = 0;
+        while (done < size) {
+            const ssize_t n = ::read(fd, storage_.data() + done, size - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) return false;
+            if (n == 0) break;
+            done += static_cast<std::size_t>(n);
+        }
+        storage_.resize(done);  // файл укоротили между fstat и read — берём что есть
+        data_ = storage_.data();
+        size_ = storage_.size();
+        return true;
+    }
+#endif
+
+    // Запасной путь: один read на весь файл
+    bool ReadAll(const fs::path& file) {
+        std::ifstream in(file, std::ios::binary);
+        if (!in.is_open()) return false;
+        in.seekg(0, std::ios::end);
+        const std::streamoff len = in.tellg();
+        in.seekg(0, std::ios::beg);
+        if (len > 0) {
+            storage_.resize(static_cast<std::size_t>(len));
+            in.read(storage_.data(), len);
+            storage_.resize(static_cast<std::size_t>(in.gcount()));
+        } else {
+            // размер неизвестен (pipe и т.п.) — читаем как есть
+            storage_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+        data_ = storage_.data();
+        size_ = storage_.size();
+        return true;
+    }
+
+    void Reset() {
+#ifdef V2_HAVE_MMAP
+        if (mapped_) ::munmap(const_cast<char*>(data_), size_);
+#endif
+        data_ = nullptr;
+        size_ = 0;
+        mapped_ = false;
+        borrowed_ = false;
+        storage_.clear();
+    }
+
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+    bool mapped_ = false;
+    bool borrowed_ = false;
+    std::string storage_;
+};
+
+// =======================
+// Нормализация текста: весь буфер за один проход
+// =======================
+//
+// UTF-8 BOM убирается, UTF-16LE/BE с BOM перекодируется в UTF-8, концы строк
+// CRLF и одиночный CR становятся LF (одиночный CR компилятор тоже считает
+// концом строки). Чистый файл — UTF-8 и только LF — не копируется: результат
+// смотрит в исходный буфер, вся работа — memchr в поисках '\r'.
+// Кодировки без BOM не угадываются: такой файл читается как UTF-8.
+
+namespace detail {
+
+inline std::size_t LowestBit(unsigned mask) {
+#if defined(__GNUC__)
+    return static_cast<std::size_t>(__builtin_ctz(mask));
+#else
+    std::size_t n = 0;
+    while (!(mask & 1u)) {
+        mask >>= 1;
+        ++n;
+    }
+    return n;
+#endif
+}
+
+// CRLF/CR -> LF из src в dst (dst не короче n); возвращает длину результата.
+// Куски без '\r' копируются по 16 байт (SSE2) или memchr + memcpy.
+inline std::size_t CopyCRToLF(const char* src, std::size_t n, char* dst) {
+    const char* const end = src + n;
+    char* const dst_start = dst;
+    while (src < end) {
+#ifdef V2_HAVE_SSE2
+        if (end - src >= 16) {
+            const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+            const unsigned mask =
+                static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8('\r'))));
+            // dst не впереди src, так что 16 байт всегда помещаются
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), block);
+            if (mask == 0) {
+                src += 16;
+                dst += 16;
+                continue;
+            }
+            const std::size_t at = LowestBit(mask);  // байты до '\r' уже на месте
+            src += at;
+            dst += at;
+        } else
+#endif
+        {
+            const void* cr = std::memchr(src, '\r', static_cast<std::size_t>(end - src));
+            const std::size_t len = cr ? static_cast<std::size_t>(static_cast<const char*>(cr) - src)
+                                       : static_cast<std::size_t>(end - src);
+            std::memcpy(dst, src, len);
+            src += len;
+            dst += len;
+            if (!cr) break;
+        }
+        *dst++ = '\n';  // *src == '\r'
+        if (++src < end && *src == '\n') ++src;
+    }
+    return static_cast<std::size_t>(dst - dst_start);
+}
+
+inline char* PutUtf8(char* out, std::uint32_t cp) {
+    if (cp < 0x80) {
+        *out++ = static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        *out++ = static_cast<char>(0xC0 | (cp >> 6));
+        *out++ = static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        *out++ = static_cast<char>(0xE0 | (cp >> 12));
+        *out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        *out++ = static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+        *out++ = static_cast<char>(0xF0 | (cp >> 18));
+        *out++ = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        *out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        *out++ = static_cast<char>(0x80 | (cp & 0x3F));
+    }
+    return out;
+}
+
+// Результат растёт кусками по столько байт входа: resize заполняет нулями только
+// свежий кусок, и он ещё в кэше, когда поверх пишется текст (resize на весь
+// файл сразу стоил дороже самой нормализации)
+constexpr std::size_t kNormalizeChunk = 64 * 1024;
+
+// Кусок UTF-16 (units символов) -> UTF-8 с CRLF/CR -> LF. Пара "\r\n" и
+// суррогатная пара не должны рваться на границе куска: это решает вызывающий.
+// Непарный суррогат -> U+FFFD. Пишет в dst не больше 3 байт на символ.
+inline char* Utf16ChunkToUtf8(const unsigned char* p, std::size_t units, bool little_endian, char* dst) {
+    const auto unit = [&](std::size_t i) -> std::uint32_t {
+        return little_endian ? p[2 * i] | (p[2 * i + 1] << 8) : (p[2 * i] << 8) | p[2 * i + 1];
+    };
+    std::size_t i = 0;
+    while (i < units) {
+#ifdef V2_HAVE_SSE2
+        // 8 символов ASCII без '\r' подряд — упаковываются в 8 байт разом
+        if (units - i >= 8) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 2 * i));
+            if (!little_endian) block = _mm_or_si128(_mm_slli_epi16(block, 8), _mm_srli_epi16(block, 8));
+            const __m128i high = _mm_and_si128(block, _mm_set1_epi16(static_cast<short>(0xFF80)));
+            const bool ascii = _mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) == 0xFFFF;
+            const bool has_cr = _mm_movemask_epi8(_mm_cmpeq_epi16(block, _mm_set1_epi16('\r'))) != 0;
+            if (ascii && !has_cr) {
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(dst), _mm_packus_epi16(block, block));
+                dst += 8;
+                i += 8;
+                continue;
+            }
+        }
+#endif
+        std::uint32_t cp = unit(i++);
+        if (cp == '\r') {
+            *dst++ = '\n';
+            if (i < units && unit(i) == '\n') ++i;
+            continue;
+        }
+        if (cp >= 0xD800 && cp <= 0xDFFF) {
+            const std::uint32_t low = i < units ? unit(i) : 0;
+            if (cp <= 0xDBFF && low >= 0xDC00 && low <= 0xDFFF) {
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                ++i;
+            } else {
+                cp = 0xFFFD;
+            }
+        }
+        dst = PutUtf8(dst, cp);
+    }
+    return dst;
+}
+
+// UTF-16 (без BOM) -> UTF-8 в out; лишний последний байт -> U+FFFD
+inline void Utf16ToUtf8(std::string_view bytes, bool little_endian, std::string& out) {
+    const auto* p = reinterpret_cast<const unsigned char*>(bytes.data());
+    const std::size_t units = bytes.size() / 2;
+    const auto unit = [&](std::size_t i) -> std::uint32_t {
+        return little_endian ? p[2 * i] | (p[2 * i + 1] << 8) : (p[2 * i] << 8) | p[2 * i + 1];
+    };
+    out.clear();
+    out.reserve(bytes.size());  // ASCII вдвое короче, кириллица — столько же
+    for (std::size_t i = 0; i < units;) {
+        std::size_t n = std::min(kNormalizeChunk / 2, units - i);
+        // "\r\n" и суррогатная пара остаются в одном куске
+        if (i + n < units && (unit(i + n - 1) == '\r' || (unit(i + n - 1) >= 0xD800 && unit(i + n - 1) <= 0xDBFF))) ++n;
+        const std::size_t at = out.size();
+        out.resize(at + n * 3);
+        char* const end = Utf16ChunkToUtf8(p + 2 * i, n, little_endian, out.data() + at);
+        out.resize(static_cast<std::size_t>(end - out.data()));
+        i += n;
+    }
+    if (bytes.size() % 2 != 0) {
+        char tail[4];
+        out.append(tail, static_cast<std::size_t>(PutUtf8(tail, 0xFFFD) - tail));
+    }
+}
+
+} // namespace detail
+
+// Текст raw после нормализации. Если менять нечего, результат — часть raw
+// (без BOM), storage не трогается; иначе результат лежит в storage.
+inline std::string_view NormalizeText(std::string_view raw, std::string& storage) {
+    if (raw.size() >= 2) {
+        const auto b0 = static_cast<unsigned char>(raw[0]);
+        const auto b1 = static_cast<unsigned char>(raw[1]);
+        if ((b0 == 0xFF && b1 == 0xFE) || (b0 == 0xFE && b1 == 0xFF)) {
+            detail::Utf16ToUtf8(raw.substr(2), b0 == 0xFF, storage);
+            return storage;
+        }
+    }
+    StripUtf8BOM(raw);
+    const void* cr = std::memchr(raw.data(), '\r', raw.size());
+    if (cr == nullptr) return raw;
+
+    std::size_t i = static_cast<std::size_t>(static_cast<const char*>(cr) - raw.data());
+    storage.clear();
+    storage.reserve(raw.size());
+    storage.append(raw.data(), i);
+    while (i < raw.size()) {
+        std::size_t n = std::min(detail::kNormalizeChunk, raw.size() - i);
+        if (i + n < raw.size() && raw[i + n - 1] == '\r') ++n;  // "\r\n" — в одном куске
+        const std::size_t at = storage.size();
+        storage.resize(at + n);
+        storage.resize(at + detail::CopyCRToLF(raw.data() + i, n, storage.data() + at));
+        i += n;
+    }
+    return storage;
+}
+
+// Целые строки text как есть; последней строке без '\n' он добавляется
+// (так раньше работал цикл getline + out << line << '\n').
+inline void WriteText(std::ostream& out, std::string_view text) {
+    if (text.empty()) return;
+    out.write(text.data(), static_cast<std::streamsize>(text.size()));
+    if (text.back() != '\n') out.put('\n');
+}
+
+} // namespace v2
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "v2_preprocess_impl.h"
+
+namespace v2 {
+
+// =======================
+// --stats: отчёт о прогоне по RunStats — для человека или в JSON
+// =======================
+
+namespace detail {
+
+inline std::string JsonEscape(const std::string& s) {
+    std::string out;
+    for (char c : s) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    static const char hex[] = "0123456789abcdef";
+                    out += "\\u00";
+                    out += hex[(c >> 4) & 0xF];
+                    out += hex[c & 0xF];
+                } else {
+                    out += c;
+                }
+        }
+    }
+    return out;
+}
+
+inline double Ms(std::uint64_t ns) { return static_cast<double>(ns) / 1e6; }
+
+// Насколько minify уменьшил вывод, % от исходного размера
+inline double MinifySavedPercent(const RunStats& s) {
+    if (s.minify_bytes_in == 0) return 0;
+    return 100.0 * static_cast<double>(s.minify_bytes_in - s.output.bytes) / static_cast<double>(s.minify_bytes_in);
+}
+
+// Промах = запрос, на который кэш не ответил ни "найден", ни "не найден"
+inline std::size_t ResolveMisses(const ResolverStats& r) {
+    return r.lookups - r.cache_hits - r.negative_hits;
+}
+
+} // namespace detail
+
+// Счётчики нескольких прогонов в один отчёт (--batch); дорогих файлов — не больше top_files
+inline void AddRunStats(RunStats& total, const RunStats& s, std::size_t top_files) {
+    total.files += s.files;
+    total.resolver += s.resolver;
+    total.output += s.output;
+    total.once_skipped += s.once_skipped;
+    total.once_bytes_saved += s.once_bytes_saved;
+    total.max_depth = std::max(total.max_depth, s.max_depth);
+    total.inactive_includes += s.inactive_includes;
+    total.inactive_bytes += s.inactive_bytes;
+    total.minify_bytes_in += s.minify_bytes_in;
+    total.hoisted_includes += s.hoisted_includes;
+    total.system_includes += s.system_includes;
+    total.cycles_broken += s.cycles_broken;
+    if (top_files == 0) return;
+    for (const SlowFile& f : s.slowest_files) detail::RecordSlowFile(total.slowest_files, f.path, f.ns, top_files);
+}
+
+// Строки, которые flatten печатает в stdout после успешного прогона
+inline void WriteOnceSummary(std::ostream& out, const RunStats& s) {
+    if (s.once_skipped > 0) {
+        out << "include-once: пропущено повторных include: " << s.once_skipped
+            << ", сэкономлено байт: " << s.once_bytes_saved << "\n";
+    }
+    if (s.hoisted_includes > 0) {
+        out << "hoist-system: строк <...> поднято " << s.hoisted_includes
+            << ", в прологе разных " << s.system_includes << "\n";
+    }
+    if (s.minify_bytes_in > 0) {
+        out << "minify: байт " << s.minify_bytes_in << " -> " << s.output.bytes
+            << " (-" << detail::MinifySavedPercent(s) << "%)\n";
+    }
+}
+
+inline void WriteStatsText(std::ostream& out, const RunStats& s, double wall_ms) {
+    const FileCacheStats& f = s.files;
+    out << "stats: " << wall_ms << " ms\n"
+        << "  файлы: прочитано " << f.files_read << ", из кэша " << f.files_replayed
+        << ", байт прочитано " << f.bytes_read << ", строк " << f.lines_scanned
+        << ", директив " << f.directives_matched << "\n"
+        << "  поиск include: запросов " << s.resolver.lookups << ", попаданий " << s.resolver.cache_hits
+        << ", \"не найден\" из кэша " << s.resolver.negative_hits << ", промахов " << detail::ResolveMisses(s.resolver)
+        << ", обращений к ФС " << s.resolver.probes << "\n"
+        << "  вывод: байт " << s.output.bytes << " (ядром " << s.output.bytes_spliced << "), вызовов write "
+        << s.output.write_calls << ", copy_file_range/sendfile " << s.output.splice_calls
+        << (s.output.files_unchanged > 0 ? ", совпал с прежним — файл не тронут" : "") << "\n"
+        << "  время, ms: чтение " << detail::Ms(f.read_ns) << ", разбор " << detail::Ms(f.scan_ns)
+        << ", поиск include " << detail::Ms(s.resolver.probe_ns) << ", вывод " << detail::Ms(s.output.write_ns) << "\n"
+        << "  глубина include: " << s.max_depth << "\n";
+    if (s.once_skipped > 0) {
+        out << "  include-once: пропущено " << s.once_skipped << ", сэкономлено байт " << s.once_bytes_saved << "\n";
+    }
+    if (s.inactive_includes > 0) {
+        out << "  неактивные ветки #if: include не раскрыто " << s.inactive_includes
+            << ", их файлы — байт " << s.inactive_bytes << "\n";
+    }
+    if (s.cycles_broken > 0) out << "  циклы include: разорвано " << s.cycles_broken << "\n";
+    if (s.hoisted_includes > 0) {
+        out << "  hoist-system: строк <...> поднято " << s.hoisted_includes << ", в прологе " << s.system_includes << "\n";
+    }
+    if (s.minify_bytes_in > 0) {
+        out << "  minify: байт до " << s.minify_bytes_in << ", после " << s.output.bytes
+            << " (-" << detail::MinifySavedPercent(s) << "%)\n";
+    }
+    if (!s.slowest_files.empty()) {
+        out << "  самые дорогие файлы (чтение + разбор):\n";
+        for (const SlowFile& file : s.slowest_files) {
+            out << "    " << detail::Ms(file.ns) << " ms  " << file.path.string() << "\n";
+        }
+    }
+}
+
+inline void WriteStatsJson(std::ostream& out, const RunStats& s, double wall_ms) {
+    const FileCacheStats& f = s.files;
+    out << "{\"wall_ms\": " << wall_ms
+        << ", \"files_read\": " << f.files_read << ", \"files_replayed\": " << f.files_replayed
+        << ", \"bytes_read\": " << f.bytes_read << ", \"lines_scanned\": " << f.lines_scanned
+        << ", \"directives_matched\": " << f.directives_matched
+        << ", \"resolve_lookups\": " << s.resolver.lookups << ", \"resolve_hits\": " << s.resolver.cache_hits
+        << ", \"resolve_negative_hits\": " << s.resolver.negative_hits
+        << ", \"resolve_misses\": " << detail::ResolveMisses(s.resolver) << ", \"fs_probes\": " << s.resolver.probes
+        << ", \"bytes_written\": " << s.output.bytes << ", \"bytes_spliced\": " << s.output.bytes_spliced
+        << ", \"write_calls\": " << s.output.write_calls << ", \"splice_calls\": " << s.output.splice_calls
+        << ", \"outputs_unchanged\": " << s.output.files_unchanged
+        << ", \"read_ms\": " << detail::Ms(f.read_ns) << ", \"scan_ms\": " << detail::Ms(f.scan_ns)
+        << ", \"resolve_ms\": " << detail::Ms(s.resolver.probe_ns) << ", \"output_ms\": " << detail::Ms(s.output.write_ns)
+        << ", \"max_depth\": " << s.max_depth
+        << ", \"once_skipped\": " << s.once_skipped << ", \"once_bytes_saved\": " << s.once_bytes_saved
+        << ", \"inactive_includes\": " << s.inactive_includes << ", \"inactive_bytes\": " << s.inactive_bytes
+        << ", \"minify_bytes_in\": " << s.minify_bytes_in
+        << ", \"cycles_broken\": " << s.cycles_broken
+        << ", \"hoisted_includes\": " << s.hoisted_includes << ", \"system_includes\": " << s.system_includes
+        << ", \"slowest_files\": [";
+    for (std::size_t i = 0; i < s.slowest_files.size(); ++i) {
+        out << (i ? ", " : "") << "{\"path\": \"" << detail::JsonEscape(s.slowest_files[i].path.generic_string())
+            << "\", \"ms\": " << detail::Ms(s.slowest_files[i].ns) << "}";
+    }
+    out << "]}\n";
+}
+
+} // namespace v2
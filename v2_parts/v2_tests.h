@@ -0,0 +1,789 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../common/tests_common.h"
+#include "v2_batch.h"
+#include "v2_deps.h"
+#include "v2_preprocess_impl.h"
+#include "v2_server.h"
+#include "v2_stats.h"
+#include "v2_unity.h"
+#include "v2_watch.h"
+
+namespace v2::tests {
+namespace fs = std::filesystem;
+
+// Заголовок, подключённый много раз, читается с диска ровно один раз
+inline void TestFileCacheReadsOnce() {
+    std::error_code err;
+    fs::remove_all("sources_v2", err);
+    fs::create_directories(fs::path("sources_v2") / "rep", err);
+
+    {
+        std::ofstream file("sources_v2/rep/main.cpp");
+        file << "#include \"h.h\"\n"
+             << "#include \"g.h\"\n"
+             << "#include \"h.h\"\n"
+             << "#include \"h.h\"\n";
+    }
+    {
+        std::ofstream file("sources_v2/rep/g.h");
+        file << "// g\n"
+             << "#include \"h.h\"\n";
+    }
+    {
+        std::ofstream file("sources_v2/rep/h.h");
+        file << "// h\r\n";
+    }
+
+    RunStats stats;
+    bool ok = FlattenProject(fs::path("sources_v2/rep/main.cpp"), fs::path("sources_v2/rep.out"), {}, stats);
+    assert(ok);
+    assert(stats.files.files_read == 3);
+    assert(stats.files.files_replayed == 3);
+    assert(common::GetFileContents("sources_v2/rep.out") == "// h\n// g\n// h\n// h\n// h\n");
+}
+
+// Порядок поиска: папка текущего файла, затем include_directories по порядку;
+// "не найдено" кэшируется до явного Invalidate()
+inline void TestResolverOrderAndInvalidate() {
+    std::error_code err;
+    fs::remove_all("sources_v2", err);
+    fs::create_directories(fs::path("sources_v2") / "here", err);
+    fs::create_directories(fs::path("sources_v2") / "inc1" / "lib", err);
+    fs::create_directories(fs::path("sources_v2") / "inc2" / "lib", err);
+
+    std::ofstream("sources_v2/here/local.h") << "";
+    std::ofstream("sources_v2/inc1/local.h") << "";
+    std::ofstream("sources_v2/inc1/lib/x.h") << "";
+    std::ofstream("sources_v2/inc2/lib/x.h") << "";
+    std::ofstream("sources_v2/inc2/lib/y.h") << "";
+
+    IncludeResolver resolver({fs::path("sources_v2/inc1"), fs::path("sources_v2/inc2")});
+    const fs::path here("sources_v2/here");
+
+    const fs::path* found = resolver.Resolve(here, "local.h", true);
+    assert(found && *found == fs::path("sources_v2/here/local.h"));
+    found = resolver.Resolve(here, "local.h", false);
+    assert(found && *found == fs::path("sources_v2/inc1/local.h"));
+    found = resolver.Resolve(here, "lib/x.h", true);
+    assert(found && *found == fs::path("sources_v2/inc1/lib/x.h"));
+    found = resolver.Resolve(here, "lib/./y.h", true);
+    assert(found && *found == fs::path("sources_v2/inc2/lib/y.h"));
+
+    assert(resolver.Resolve(here, "new.h", true) == nullptr);
+    std::ofstream("sources_v2/inc2/new.h") << "";
+    assert(resolver.Resolve(here, "new.h", true) == nullptr);
+    assert(resolver.Stats().negative_hits == 1);
+
+    const fs::path* before = resolver.Resolve(here, "local.h", true);
+    resolver.Invalidate();
+    found = resolver.Resolve(here, "new.h", true);
+    assert(found && *found == fs::path("sources_v2/inc2/new.h"));
+    assert(resolver.Resolve(here, "local.h", true) == before);  // путь хранится один раз, адрес прежний
+
+    // каталог, токены и найденные пути интернированы по одному разу
+    const InternStats interned = resolver.Interned();
+    assert(interned.dirs == 1 && interned.tokens == 4 && interned.paths == 5);
+}
+
+// Batch на нескольких потоках даёт те же файлы и сообщения, что одиночные запуски
+inline void TestBatchMatchesSingleRuns() {
+    common::PrepareSampleFiles();
+    const std::vector<fs::path> include_dirs = {fs::path("sources/include1"), fs::path("sources/include2")};
+
+    common::CoutCapture cap;
+    cap.Begin();
+    Preprocess(fs::path("sources/a.cpp"), fs::path("sources/a.single"), include_dirs);
+    const std::string single_messages = cap.End();
+    const std::string single = common::GetFileContents("sources/a.single");
+
+    std::vector<BatchJob> jobs;
+    for (int i = 0; i < 8; ++i) {
+        BatchJob job;
+        job.in_file = "sources/a.cpp";
+        job.out_file = "sources/a.batch" + std::to_string(i);
+        jobs.push_back(std::move(job));
+    }
+    const BatchReport report = RunBatch(jobs, include_dirs, Mode::TZ, RunOptions{}, 4);
+
+    assert(report.failed == jobs.size());  // dummy.txt не находится, как и в одиночном запуске
+    for (const BatchJob& job : jobs) {
+        assert(job.messages == single_messages);
+        assert(common::GetFileContents(job.out_file) == single);
+    }
+
+    // опции прогона доходят до каждой пары
+    std::error_code err;
+    fs::create_directories("sources/batch", err);
+    std::ofstream("sources/batch/m.cpp") << "#include \"m.h\"\n// main\nint main() {}\n";
+    std::ofstream("sources/batch/m.h") << "/* doc */\n    int m; // m\n";
+    RunOptions minify;
+    minify.minify = true;
+    RunStats single_stats;
+    assert(FlattenProject(fs::path("sources/batch/m.cpp"), fs::path("sources/batch/m.single"), {}, minify, single_stats));
+    const std::string minified = common::GetFileContents("sources/batch/m.single");
+    assert(minified == "int m;\nint main() {}\n");
+
+    std::vector<BatchJob> flat_jobs(3);
+    for (std::size_t i = 0; i < flat_jobs.size(); ++i) {
+        flat_jobs[i].in_file = "sources/batch/m.cpp";
+        flat_jobs[i].out_file = "sources/batch/m.batch" + std::to_string(i);
+    }
+    const BatchReport flat_report = RunBatch(flat_jobs, {}, Mode::Flatten, minify, 2);
+    assert(flat_report.ok == flat_jobs.size());
+    for (const BatchJob& job : flat_jobs) {
+        assert(common::GetFileContents(job.out_file) == minified);
+        assert(job.stats.minify_bytes_in == single_stats.minify_bytes_in);
+    }
+}
+
+// Параллельная предзагрузка дерева не меняет ни вывод, ни место остановки по ошибке
+inline void TestParallelMatchesSequential() {
+    common::PrepareSampleFiles();
+    const std::vector<fs::path> include_dirs = {fs::path("sources/include1"), fs::path("sources/include2")};
+
+    for (Mode mode : {Mode::TZ, Mode::Flatten}) {
+        RunOptions sequential, parallel;
+        parallel.jobs = 4;
+        RunStats seq_stats, par_stats;
+
+        common::CoutCapture cap;
+        cap.Begin();
+        const bool seq_ok = mode == Mode::TZ
+            ? Preprocess_TZ(fs::path("sources/a.cpp"), fs::path("sources/a.seq"), include_dirs, sequential, seq_stats)
+            : FlattenProject(fs::path("sources/a.cpp"), fs::path("sources/a.seq"), include_dirs, sequential, seq_stats);
+        const bool par_ok = mode == Mode::TZ
+            ? Preprocess_TZ(fs::path("sources/a.cpp"), fs::path("sources/a.par"), include_dirs, parallel, par_stats)
+            : FlattenProject(fs::path("sources/a.cpp"), fs::path("sources/a.par"), include_dirs, parallel, par_stats);
+        const std::string messages = cap.End();
+
+        assert(seq_ok == par_ok);
+        assert(seq_stats.files.files_read == par_stats.files.files_read);
+        assert(common::GetFileContents("sources/a.seq") == common::GetFileContents("sources/a.par"));
+        if (mode == Mode::TZ) {
+            // одно и то же сообщение дважды
+            assert(messages.size() % 2 == 0);
+            assert(messages.substr(0, messages.size() / 2) == messages.substr(messages.size() / 2));
+        }
+    }
+}
+
+// --deps: граф в порядке раскрытия, с номерами строк; ошибка — там же, где у Preprocess
+inline void TestDepsGraph() {
+    common::PrepareSampleFiles();
+    SharedCaches caches({fs::path("sources/include1"), fs::path("sources/include2")});
+    IncludeGraph graph;
+    RunStats stats;
+
+    common::CoutCapture cap;
+    cap.Begin();
+    const bool ok = ScanIncludeGraph(fs::path("sources/a.cpp"), Mode::TZ, caches, graph, stats, std::cout);
+    const std::string captured = cap.End();
+
+    assert(!ok);
+    assert(captured.find("unknown include file dummy.txt") != std::string::npos);
+    assert(captured.find("at line 8") != std::string::npos);
+
+    const std::vector<fs::path> expected = {
+        fs::path("sources/a.cpp"), fs::path("sources/dir1/b.h"), fs::path("sources/dir1/subdir/c.h"),
+        fs::path("sources/include1/std1.h"), fs::path("sources/dir1/d.h"), fs::path("sources/include2/lib/std2.h")};
+    assert(graph.files == expected);
+    assert(graph.edges.size() == 5);
+    assert(graph.edges[2].from == 2 && graph.edges[2].to == 3 && graph.edges[2].line_no == 2 && graph.edges[2].angle);
+}
+
+// Длинные нетронутые куски уходят в выход мимо памяти процесса, но байты те же:
+// include посередине, последняя строка без '\n', файл с CRLF (его копирует writev)
+inline void TestLargeVerbatimOutput() {
+    std::error_code err;
+    fs::remove_all("sources_v2", err);
+    fs::create_directories("sources_v2", err);
+
+    std::string big;
+    for (int i = 0; big.size() < 3 * OutputWriter::kSpliceMin; ++i) big += "int v" + std::to_string(i) + " = 0;\n";
+    {
+        std::ofstream file("sources_v2/big.cpp", std::ios::binary);
+        file << big << "#include \"crlf.h\"\n" << big << "// tail";
+    }
+    {
+        std::ofstream file("sources_v2/crlf.h", std::ios::binary);
+        file << "// crlf\r\n" << big;
+    }
+
+    RunStats stats;
+    bool ok = FlattenProject(fs::path("sources_v2/big.cpp"), fs::path("sources_v2/big.out"), {}, stats);
+    assert(ok);
+    const std::string expected = big + "// crlf\n" + big + big + "// tail\n";
+    assert(common::GetFileContents("sources_v2/big.out") == expected);
+    assert(stats.output.bytes == expected.size());
+    assert(stats.output.bytes_spliced <= fs::file_size("sources_v2/big.cpp"));  // crlf.h нормализован
+
+    // исходник сохранили заново между разбором и выводом — в выход идёт разобранный текст
+    {
+        std::ofstream file("sources_v2/saved.cpp", std::ios::binary);
+        file << big;
+    }
+    FileCache cache;
+    const ParsedFile* parsed = cache.Load(fs::path("sources_v2/saved.cpp"));
+    assert(parsed);
+    {
+        std::ofstream file("sources_v2/saved.tmp", std::ios::binary);
+        file << "// new\n" << big;
+    }
+    fs::rename("sources_v2/saved.tmp", "sources_v2/saved.cpp");
+    OutputWriter out;
+    assert(out.Open("sources_v2/saved.out"));
+    const std::string_view whole = parsed->source.View();
+    for (const Segment& seg : parsed->segments) {
+        out.WriteTextFromFile(seg.text, "sources_v2/saved.cpp", static_cast<std::uint64_t>(seg.text.data() - whole.data()),
+                              parsed->stamp);
+    }
+    assert(out.Close());
+    assert(common::GetFileContents("sources_v2/saved.out") == big);
+}
+
+// Нормализация целого буфера: чистый текст не копируется, CRLF и одиночный CR
+// (в том числе на стыке 16-байтных блоков) -> LF, UTF-16 с BOM -> UTF-8
+inline void TestNormalizeText() {
+    std::string storage;
+    const std::string clean = "\xEF\xBB\xBF// clean\n#include \"a.h\"\n";
+    const std::string_view view = NormalizeText(clean, storage);
+    assert(view.data() == clean.data() + 3 && view == "// clean\n#include \"a.h\"\n" && storage.empty());
+
+    // сверка с посимвольной заменой на всех длинах и положениях '\r' вокруг границы блока
+    const auto reference = [](const std::string& in) {
+        std::string out;
+        for (std::size_t i = 0; i < in.size(); ++i) {
+            if (in[i] != '\r') {
+                out += in[i];
+                continue;
+            }
+            out += '\n';
+            if (i + 1 < in.size() && in[i + 1] == '\n') ++i;
+        }
+        return out;
+    };
+    for (std::size_t len = 1; len < 40; ++len) {
+        for (std::size_t cr = 0; cr < len; ++cr) {
+            std::string in(len, 'x');
+            in[cr] = '\r';
+            if (cr + 1 < len) in[cr + 1] = '\n';
+            if (cr + 5 < len) in[cr + 5] = '\r';  // одиночный CR
+            assert(NormalizeText(in, storage) == reference(in));
+        }
+    }
+    assert(NormalizeText("a\r\r\nb\r", storage) == "a\n\nb\n");
+
+    // UTF-16: ASCII длиннее блока, кириллица, суррогатная пара, непарный суррогат, лишний байт
+    const std::u16string text16 = u"#include \"a.h\"\r\n// привет \U0001F600\r";
+    const std::string utf8 = "#include \"a.h\"\n// \xD0\xBF\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82 \xF0\x9F\x98\x80\n";
+    std::string le = "\xFF\xFE", be = "\xFE\xFF";
+    for (char16_t c : text16) {
+        le += static_cast<char>(c & 0xFF);
+        le += static_cast<char>(c >> 8);
+        be += static_cast<char>(c >> 8);
+        be += static_cast<char>(c & 0xFF);
+    }
+    assert(NormalizeText(le, storage) == utf8);
+    assert(NormalizeText(be, storage) == utf8);
+    assert(NormalizeText(std::string("\xFF\xFE\x00\xD8x\x00y", 7), storage) == "\xEF\xBF\xBDx\xEF\xBF\xBD");
+
+    // через движок: include в файле UTF-16LE раскрывается
+    std::error_code err;
+    fs::remove_all("sources_v2", err);
+    fs::create_directories("sources_v2", err);
+    std::ofstream("sources_v2/wide.cpp", std::ios::binary) << le;
+    std::ofstream("sources_v2/a.h", std::ios::binary) << "// a\r";
+    assert(FlattenProject(fs::path("sources_v2/wide.cpp"), fs::path("sources_v2/wide.out"), {}));
+    assert(common::GetFileContents("sources_v2/wide.out") == "// a\n" + utf8.substr(utf8.find('\n') + 1));
+}
+
+// Цикл include останавливается на повторном входе в файл; при break_cycles — пропускается
+inline void TestIncludeCycleStops() {
+    std::error_code err;
+    fs::remove_all("sources_v2", err);
+    fs::create_directories("sources_v2", err);
+    std::ofstream("sources_v2/a.h") << "#include \"b.h\"\n";
+    std::ofstream("sources_v2/b.h") << "// b\n#include \"a.h\"\n";
+
+    common::CoutCapture cap;
+    cap.Begin();
+    const bool tz_ok = Preprocess(fs::path("sources_v2/a.h"), fs::path("sources_v2/a.out"), {});
+    const bool flat_ok = FlattenProject(fs::path("sources_v2/a.h"), fs::path("sources_v2/a.flat"), {});
+    const std::string captured = cap.End();
+
+    assert(!tz_ok && !flat_ok);
+    const std::string chain = "sources_v2/a.h:1 -> sources_v2/b.h:2 -> sources_v2/a.h\n";
+    assert(captured == "include cycle: " + chain + "include cycle: " + chain);
+
+    // break_cycles: замыкающий include пропускается, склейка продолжается
+    RunOptions options;
+    options.break_cycles = true;
+    RunStats stats;
+    common::CoutCapture broken_cap;
+    broken_cap.Begin();
+    const bool broken_ok = FlattenProject(fs::path("sources_v2/a.h"), fs::path("sources_v2/a.flat"), {}, options, stats);
+    const std::string broken = broken_cap.End();
+    assert(broken_ok && stats.cycles_broken == 1);
+    assert(broken == "include cycle skipped: " + chain);
+    assert(common::GetFileContents("sources_v2/a.flat") == "// b\n");
+}
+
+// --stats: счётчики сходятся с тем, что лежит на диске; без top_files список пуст
+inline void TestRunStatsCounters() {
+    common::PrepareSampleFiles();
+    const std::vector<fs::path> include_dirs = {fs::path("sources/include1"), fs::path("sources/include2")};
+
+    RunOptions options;
+    options.top_files = 2;
+    RunStats stats;
+    bool ok = FlattenProject(fs::path("sources/a.cpp"), fs::path("sources/a.stats"), include_dirs, options, stats);
+    assert(ok);
+
+    assert(stats.files.files_read > 0 && stats.files.bytes_read > 0);
+    assert(stats.files.lines_scanned >= stats.files.directives_matched && stats.files.directives_matched > 0);
+    assert(stats.output.bytes == fs::file_size("sources/a.stats"));
+    assert(stats.max_depth == 3);  // a.cpp -> dir1/b.h -> subdir/c.h
+    assert(stats.slowest_files.size() == 2 && stats.slowest_files[0].ns >= stats.slowest_files[1].ns);
+
+    std::ostringstream json;
+    WriteStatsJson(json, stats, 1.0);
+    assert(json.str().find("\"max_depth\": 3") != std::string::npos);
+
+    RunStats quiet;
+    FlattenProject(fs::path("sources/a.cpp"), fs::path("sources/a.stats"), include_dirs, quiet);
+    assert(quiet.slowest_files.empty() && quiet.max_depth == 3);
+}
+
+// Файлы из памяти и вывод в строку дают ровно то же, что прогон по диску,
+// включая сообщения об ошибках
+inline void TestInMemoryMatchesDisk() {
+    common::PrepareSampleFiles();
+    const std::vector<fs::path> include_dirs = {fs::path("sources/include1"), fs::path("sources/include2")};
+    std::ofstream("sources/crlf.cpp", std::ios::binary) << "\xEF\xBB\xBF// crlf\r\n#include \"dir1/d.h\"\r\n#include <std1.h>\r\n";
+
+    MemoryFileProvider memory;
+    for (const auto& entry : fs::recursive_directory_iterator("sources")) {
+        if (!entry.is_regular_file()) continue;
+        std::ifstream in(entry.path(), std::ios::binary);
+        std::ostringstream text;
+        text << in.rdbuf();
+        memory.Add(entry.path(), text.str());
+    }
+
+    for (const char* in_name : {"sources/a.cpp", "sources/crlf.cpp"}) {
+        const fs::path in_file(in_name);
+        for (const bool tz : {true, false}) {
+            const std::string before = common::GetFileContents("sources/mem.out");
+            common::CoutCapture disk_cap;
+            disk_cap.Begin();
+            const bool disk_ok = tz ? Preprocess(in_file, fs::path("sources/mem.out"), include_dirs)
+                                    : FlattenProject(in_file, fs::path("sources/mem.out"), include_dirs);
+            const std::string disk_log = disk_cap.End();
+
+            StringSink sink;
+            common::CoutCapture mem_cap;
+            mem_cap.Begin();
+            const bool mem_ok = tz ? Preprocess(in_file, sink, include_dirs, memory)
+                                   : FlattenProject(in_file, sink, include_dirs, memory);
+            const std::string mem_log = mem_cap.End();
+
+            assert(mem_ok == disk_ok);
+            assert(mem_log == disk_log);
+            // неудачная склейка прежний файл не трогает; в памяти остаётся то, что успело
+            const std::string after = common::GetFileContents("sources/mem.out");
+            assert(tz || disk_ok ? sink.Text() == after : after == before);
+        }
+    }
+
+    StringSink sink;
+    assert(!Preprocess(fs::path("sources/missing.cpp"), sink, include_dirs, memory));
+    assert(sink.Text().empty());
+}
+
+// Сервер отвечает как одиночный запуск и замечает правки между запросами:
+// изменённый файл перечитывается, появившийся include находится
+inline void TestServeRevalidates() {
+    common::PrepareSampleFiles();
+    const std::vector<fs::path> include_dirs = {fs::path("sources/include1"), fs::path("sources/include2")};
+
+    common::CoutCapture cap;
+    cap.Begin();
+    const bool tz_ok = Preprocess(fs::path("sources/a.cpp"), fs::path("sources/one.tz"), include_dirs);
+    FlattenProject(fs::path("sources/a.cpp"), fs::path("sources/one.flat"), include_dirs);
+    const std::string one_shot = cap.End();
+    assert(!tz_ok);  // a.cpp подключает несуществующий dummy.txt
+
+    SharedCaches caches(include_dirs);
+    std::istringstream requests("flatten sources/a.cpp sources/srv.flat\n"
+                                "\n"
+                                "tz sources/a.cpp sources/srv.tz\n"
+                                "oops\n");
+    std::ostringstream replies;
+    ServeReport report = Serve(requests, replies, caches);
+    assert(report.requests == 3 && report.failed == 2);
+    assert(common::GetFileContents("sources/srv.flat") == common::GetFileContents("sources/one.flat"));
+    assert(common::GetFileContents("sources/srv.tz") == common::GetFileContents("sources/one.tz"));
+
+    // в ответах — те же сообщения, что у одиночных запусков, плюс строки "= код ms"
+    std::istringstream lines(replies.str());
+    std::string line, messages;
+    std::vector<std::string> codes;
+    while (std::getline(lines, line)) {
+        if (line.rfind("= ", 0) == 0) codes.push_back(line.substr(2, 1));
+        else if (line.rfind("bad request", 0) != 0) messages += line + "\n";
+    }
+    assert((codes == std::vector<std::string>{"0", "1", "2"}));
+    assert(messages == one_shot);
+
+    // правка файла (размер другой) — перечитывается, остальные берутся из кэша
+    std::ofstream("sources/dir1/d.h", std::ios::app) << "// edited\n";
+    std::istringstream again("flatten sources/a.cpp sources/srv.flat\nquit\nflatten x y\n");
+    std::ostringstream sink;
+    report = Serve(again, sink, caches);
+    assert(report.requests == 1 && report.files_dropped == 1);
+    assert(common::GetFileContents("sources/srv.flat").find("// edited\n") != std::string::npos);
+
+    // файлы из памяти: не найденный раньше include появляется
+    MemoryFileProvider memory;
+    memory.Add("mem/main.cpp", "#include \"late.h\"\n");
+    SharedCaches mem_caches({}, memory);
+    RunStats mem_stats;
+    StringSink first;
+    assert(!detail::ExpandProject("mem/main.cpp", first, Mode::Flatten, RunOptions{}, mem_caches, mem_stats, std::cout));
+    memory.Add("mem/late.h", "// late\n");
+    assert(mem_caches.resolver.Revalidate());
+    mem_caches.files.Revalidate();
+    StringSink second;
+    assert(detail::ExpandProject("mem/main.cpp", second, Mode::Flatten, RunOptions{}, mem_caches, mem_stats, std::cout));
+    assert(second.Text() == "// late\n");
+}
+
+// -D и #if: include в заведомо неактивных ветках не раскрываются (и не ищутся
+// как ошибка), непонятные условия раскрываются как раньше
+inline void TestConditionalSkipsInactive() {
+    std::error_code err;
+    fs::remove_all("sources_v2", err);
+    fs::create_directories("sources_v2", err);
+    {
+        std::ofstream file("sources_v2/main.cpp");
+        file << "#define FEATURE 2\n"
+             << "#if 0\n#include \"zero.h\"\n#endif\n"
+             << "#ifdef _WIN32\n#include \"win.h\"\n#else\n#include \"posix.h\"\n#endif\n"
+             << "#if FEATURE > 1 && \\\n    !defined(NO_EXTRA)\n#include \"extra.h\"\n#elif 1\n#include \"never.h\"\n#endif\n"
+             << "#if __cplusplus >= 201703L\n#include \"cpp17.h\"\n#endif\n"
+             << "#include \"guarded.h\"\n"
+             << "#include \"guarded.h\"\n";
+    }
+    std::ofstream("sources_v2/win.h") << "// win\n";
+    std::ofstream("sources_v2/posix.h") << "// posix\n";
+    std::ofstream("sources_v2/extra.h") << "// extra\n";
+    std::ofstream("sources_v2/cpp17.h") << "// cpp17\n";
+    std::ofstream("sources_v2/guarded.h") << "#ifndef G_H\n#define G_H\n#include \"inner.h\"\n#endif\n";
+    std::ofstream("sources_v2/inner.h") << "// inner\n";
+
+    RunOptions options;
+    options.conditional = true;
+    RunStats stats;
+    bool ok = Preprocess_TZ(fs::path("sources_v2/main.cpp"), fs::path("sources_v2/main.out"), {}, options, stats);
+    assert(ok);
+    assert(common::GetFileContents("sources_v2/main.out") ==
+           "#define FEATURE 2\n"
+           "#if 0\n#include \"zero.h\"\n#endif\n"
+           "#ifdef _WIN32\n#include \"win.h\"\n#else\n// posix\n#endif\n"
+           "#if FEATURE > 1 && \\\n    !defined(NO_EXTRA)\n// extra\n#elif 1\n#include \"never.h\"\n#endif\n"
+           "#if __cplusplus >= 201703L\n// cpp17\n#endif\n"
+           "#ifndef G_H\n#define G_H\n// inner\n#endif\n"
+           "#ifndef G_H\n#define G_H\n#include \"inner.h\"\n#endif\n");
+    assert(stats.inactive_includes == 4);  // zero, win, never и inner во второй раз
+    assert(stats.inactive_bytes == fs::file_size("sources_v2/win.h") + fs::file_size("sources_v2/inner.h"));
+
+    options.defines = {"_WIN32"};
+    RunStats flat;
+    ok = FlattenProject(fs::path("sources_v2/main.cpp"), fs::path("sources_v2/main.flat"), {}, options, flat);
+    assert(ok);
+    const std::string flattened = common::GetFileContents("sources_v2/main.flat");
+    assert(flattened.find("// win\n#else\n#include \"posix.h\"\n") != std::string::npos);
+    assert(flat.inactive_includes == 3 && flat.once_skipped == 1);
+
+    // #define FEATURE 2 перекрывает -D; NO_EXTRA выключает extra.h — берётся never.h, а его нет
+    options.defines = {"NO_EXTRA", "FEATURE=0"};
+    RunStats failed;
+    assert(!FlattenProject(fs::path("sources_v2/main.cpp"), fs::path("sources_v2/main.flat"), {}, options, failed));
+
+    assert(EvaluateCondition("(1 ? 2 : 3) == 2 && 0x10 >> 4 == 1 && -1 < 0", MacroTable{}) == Truth::True);
+    assert(EvaluateCondition("defined(__GNUC__) || 0", MacroTable{}) == Truth::Unknown);
+    assert(EvaluateCondition("0 && __GNUC__ > 4", MacroTable{}) == Truth::False);
+    assert(EvaluateCondition("1 / 0", MacroTable{}) == Truth::Unknown);
+    // беззнаковые операнды, переполнение
+    assert(EvaluateCondition("-1 > 0u", MacroTable{}) == Truth::True);
+    assert(EvaluateCondition("-1 < 0u", MacroTable{}) == Truth::False);
+    assert(EvaluateCondition("0xFFFFFFFFFFFFFFFF > 0", MacroTable{}) == Truth::True);
+    assert(EvaluateCondition("-1u >> 63 == 1 && -1 >> 63 == -1", MacroTable{}) == Truth::True);
+    assert(EvaluateCondition("-2 / 2u > 1 && (1 ? -1 : 0u) > 0", MacroTable{}) == Truth::True);
+    assert(EvaluateCondition("(-9223372036854775807 - 1) / -1", MacroTable{}) == Truth::Unknown);
+    assert(EvaluateCondition("(-9223372036854775807 - 1) % -1", MacroTable{}) == Truth::Unknown);
+    assert(EvaluateCondition("18446744073709551616 > 0", MacroTable{}) == Truth::Unknown);
+
+    // #define/#undef в ветке "не знаю" и в #else после неё — имя "может быть определено"
+    std::ofstream("sources_v2/gcc.cpp") << "#ifdef __GNUC__\n#define HAVE_GCC 1\n#undef FEATURE\n"
+                                           "#else\n#define NO_GCC 1\n#endif\n"
+                                           "#ifndef NO_GCC\n#include \"extra.h\"\n#endif\n"
+                                           "#if HAVE_GCC\n#include \"posix.h\"\n#endif\n"
+                                           "#ifdef FEATURE\n#include \"cpp17.h\"\n#endif\n";
+    options.defines = {"FEATURE"};
+    RunStats uncertain;
+    ok = FlattenProject(fs::path("sources_v2/gcc.cpp"), fs::path("sources_v2/gcc.flat"), {}, options, uncertain);
+    assert(ok && uncertain.inactive_includes == 0);
+    const std::string gcc = common::GetFileContents("sources_v2/gcc.flat");
+    assert(gcc.find("// extra\n") != std::string::npos && gcc.find("// posix\n") != std::string::npos &&
+           gcc.find("// cpp17\n") != std::string::npos);
+
+    // без conditional всё как раньше: zero.h не найден
+    common::CoutCapture cap;
+    cap.Begin();
+    ok = Preprocess(fs::path("sources_v2/main.cpp"), fs::path("sources_v2/main.out"), {});
+    const std::string captured = cap.End();
+    assert(!ok && captured == "unknown include file zero.h at file sources_v2/main.cpp at line 3\n");
+}
+
+// --minify: комментарии, отступы и пустые строки уходят, литералы и raw-строки
+// остаются как есть — и всё равно, какими кусками пришёл текст
+inline void TestMinifyKeepsLiterals() {
+    const std::string source =
+        "// header comment\n"
+        "#define SQ(x) ((x) * (x))  /* square */\n"
+        "\n"
+        "   \t\n"
+        "int a = 1'000; /* multi\n line */ int b = 2;\n"
+        "const char* s = \"not // a comment /* here */\";\n"
+        "char c = '\"'; char d = '/'; char e = '\\'';\n"
+        "auto r = R\"inc(keep /* this */\n   // and \"this\"\n)inc\";\n"
+        "auto u = u8R\"(x)\" \"/*\";\n"
+        "#define LONG a \\\n    b\n"
+        "// continued comment \\\n still comment\n"
+        "x = y / z;    // tail\n"
+        "int f/**/g;/*/ still */\n"
+        "    indented();";
+    const std::string expected =
+        "#define SQ(x) ((x) * (x))\n"
+        "int a = 1'000; int b = 2;\n"
+        "const char* s = \"not // a comment /* here */\";\n"
+        "char c = '\"'; char d = '/'; char e = '\\'';\n"
+        "auto r = R\"inc(keep /* this */\n   // and \"this\"\n)inc\";\n"
+        "auto u = u8R\"(x)\" \"/*\";\n"
+        "#define LONG a \\\n b\n"
+        "x = y / z;\n"
+        "int f g;\n"
+        "indented();";
+
+    for (const std::size_t chunk : {source.size(), std::size_t{1}, std::size_t{7}}) {
+        StringSink sink;
+        MinifySink minify(sink);
+        for (std::size_t pos = 0; pos < source.size(); pos += chunk) {
+            minify.Write(std::string_view(source).substr(pos, chunk));
+        }
+        assert(minify.Close());
+        assert(sink.Text() == expected);
+        assert(minify.BytesIn() == source.size() && minify.Stats().bytes == expected.size());
+    }
+
+    // через движок: то же, что MinifySink поверх обычного вывода
+    common::PrepareSampleFiles();
+    const std::vector<fs::path> include_dirs = {fs::path("sources/include1"), fs::path("sources/include2")};
+    RunOptions options;
+    options.minify = true;
+    RunStats stats;
+    assert(FlattenProject(fs::path("sources/a.cpp"), fs::path("sources/a.min"), include_dirs, options, stats));
+    assert(FlattenProject(fs::path("sources/a.cpp"), fs::path("sources/a.flat"), include_dirs));
+    const std::string flat = common::GetFileContents("sources/a.flat");
+    StringSink sink;
+    MinifySink minify(sink);
+    minify.Write(flat);
+    minify.Close();
+    assert(common::GetFileContents("sources/a.min") == sink.Text());
+    assert(stats.minify_bytes_in == flat.size() && stats.output.bytes == sink.Text().size());
+}
+
+// --hoist-system: <...> вне #if (guard не в счёт) — один раз в начало,
+// остальные на месте; пролог можно вынести в отдельный заголовок
+inline void TestHoistSystemIncludes() {
+    std::error_code err;
+    fs::remove_all("sources_v2", err);
+    fs::create_directories("sources_v2", err);
+    std::ofstream("sources_v2/main.cpp") << "#include <vector>\n#include \"a.h\"\n"
+                                         << "#ifdef USE_MAP\n#include <map>\n#endif\n"
+                                         << "#if 1\n#include \"b.h\"\n#endif\n"
+                                         << "#include <string>\nint main() {}\n";
+    std::ofstream("sources_v2/a.h") << "#ifndef A_H\n#define A_H\n#include <string>\n#include <vector>\n"
+                                    << "#ifdef _WIN32\n#include <windows.h>\n#endif\n"
+                                    << "#include <cstdio>\n#endif\n";
+    std::ofstream("sources_v2/b.h") << "#include <set>\n// b\n";
+    const std::string body =
+        "#ifndef A_H\n#define A_H\n#ifdef _WIN32\n#include <windows.h>\n#endif\n#endif\n"
+        "#ifdef USE_MAP\n#include <map>\n#endif\n"
+        "#if 1\n#include <set>\n// b\n#endif\n"
+        "int main() {}\n";
+
+    RunOptions options;
+    options.hoist_system = true;
+    RunStats stats;
+    assert(FlattenProject(fs::path("sources_v2/main.cpp"), fs::path("sources_v2/main.flat"), {}, options, stats));
+    assert(common::GetFileContents("sources_v2/main.flat") ==
+           "#include <vector>\n#include <string>\n#include <cstdio>\n" + body);
+    assert(stats.hoisted_includes == 5 && stats.system_includes == 3);
+
+    options.system_header = "sources_v2/sys.h";
+    for (int run = 0; run < 2; ++run) {
+        RunStats pch;
+        assert(FlattenProject(fs::path("sources_v2/main.cpp"), fs::path("sources_v2/main.flat"), {}, options, pch));
+        assert(common::GetFileContents("sources_v2/main.flat") == "#include \"sys.h\"\n" + body);
+        assert(common::GetFileContents("sources_v2/sys.h") ==
+               "#include <vector>\n#include <string>\n#include <cstdio>\n");
+        // тот же пролог — заголовок не переписывается (иначе устареет .gch)
+        if (run == 0) fs::last_write_time("sources_v2/sys.h", fs::file_time_type{}, err);
+    }
+    assert(fs::last_write_time("sources_v2/sys.h", err) == fs::file_time_type{});
+}
+
+// --unity: TU по порядку путей режутся на отрезки близкой цены; в каждом
+// shard'е общий заголовок один раз; повторный прогон даёт те же байты
+inline void TestUnityShards() {
+    assert((PlanShardBounds({10, 10, 10, 10, 40}, 2) == std::vector<std::size_t>{0, 4}));
+    assert((PlanShardBounds({5, 100, 5, 5}, 3) == std::vector<std::size_t>{0, 1, 2}));
+    assert((PlanShardBounds({1, 1}, 5) == std::vector<std::size_t>{0, 1}));
+
+    std::error_code err;
+    fs::remove_all("sources_v2", err);
+    fs::create_directories("sources_v2/out", err);
+    std::ofstream("sources_v2/common.h") << "#pragma once\n#include <vector>\n// common\n";
+    const std::vector<std::string> names = {"d.cpp", "a.cpp", "c.cpp", "b.cpp"};
+    for (std::size_t i = 0; i < names.size(); ++i) {
+        std::ofstream unit("sources_v2/" + names[i]);
+        unit << "#include \"common.h\"\n" << std::string(100 * (i + 1), 'x') << "\n";
+    }
+    std::istringstream list("# TU\nsources_v2/d.cpp\nsources_v2/a.cpp\n\nsources_v2/c.cpp\nsources_v2/b.cpp\n");
+    const std::vector<fs::path> units = ReadUnitList(list);
+    assert(units.size() == 4);
+
+    std::string first_run;
+    for (int run = 0; run < 2; ++run) {
+        SharedCaches caches({});
+        std::vector<UnityShard> shards;
+        RunStats stats;
+        assert(FlattenShards(units, "sources_v2/out", 2, caches, RunOptions{}, shards, stats, std::cout));
+        // цены 229/429/329/129 (a/b/c/d), половина — 558: a+b = 658 к ней ближе, чем a = 229
+        assert(shards.size() == 2);
+        assert((shards[0].units == std::vector<fs::path>{"sources_v2/a.cpp", "sources_v2/b.cpp"}));
+        assert((shards[1].units == std::vector<fs::path>{"sources_v2/c.cpp", "sources_v2/d.cpp"}));
+        assert(stats.files.files_read == 5);
+
+        const std::string shard0 = common::GetFileContents("sources_v2/out/unity_0.cpp");
+        assert(shard0 == "#include <vector>\n// common\n" + std::string(200, 'x') + "\n" + std::string(400, 'x') + "\n");
+        const std::string both = shard0 + common::GetFileContents("sources_v2/out/unity_1.cpp");
+        if (run == 0) first_run = both;
+        assert(both == first_run);
+    }
+
+    // shard'ов стало меньше: лишние от прошлого прогона удалены, чужие файлы целы
+    std::ofstream("sources_v2/out/unity_1_sys.h") << "// old\n";
+    std::ofstream("sources_v2/out/unity_all.cpp") << "// mine\n";
+    SharedCaches caches({});
+    std::vector<UnityShard> shards;
+    RunStats stats;
+    assert(FlattenShards(units, "sources_v2/out", 1, caches, RunOptions{}, shards, stats, std::cout));
+    assert(shards.size() == 1 && fs::exists("sources_v2/out/unity_0.cpp"));
+    assert(!fs::exists("sources_v2/out/unity_1.cpp") && !fs::exists("sources_v2/out/unity_1_sys.h"));
+    assert(fs::exists("sources_v2/out/unity_all.cpp"));
+
+    // цены — с теми же опциями, что и склейка: неактивный include не в счёт
+    std::ofstream("sources_v2/a.cpp") << "#if 0\n#include \"big.h\"\n#endif\n";
+    std::ofstream("sources_v2/big.h") << std::string(10000, 'x') << "\n";
+    RunOptions conditional;
+    conditional.conditional = true;
+    SharedCaches fresh({});
+    assert(FlattenShards(units, "sources_v2/out", 2, fresh, conditional, shards, stats, std::cout));
+    // цены a/b/c/d — 30/429/329/129 (а не 10000+ у a): половина 458, a+b = 459
+    assert((shards[0].units == std::vector<fs::path>{"sources_v2/a.cpp", "sources_v2/b.cpp"}));
+    assert(shards[0].cost == 30 + 429);
+}
+
+// --watch: правка файла и новый файл, перекрывающий найденный include, доходят до вывода
+inline void TestWatchRebuilds() {
+    std::error_code err;
+    fs::remove_all("sources_v2", err);
+    fs::create_directories("sources_v2/inc1", err);
+    fs::create_directories("sources_v2/inc2", err);
+    std::ofstream("sources_v2/main.cpp") << "#include \"a.h\"\n#include \"b.h\"\nmain\n";
+    std::ofstream("sources_v2/inc2/a.h") << "a2\n";
+    std::ofstream("sources_v2/inc2/b.h") << "b2\n";
+
+    SharedCaches caches({fs::path("sources_v2/inc1"), fs::path("sources_v2/inc2")});
+    std::atomic<bool> stop{false};
+    std::atomic<std::size_t> ready{0};
+    std::ostringstream log;
+    WatchReport report;
+    std::thread watcher([&] {
+        report = Watch("sources_v2/main.cpp", "sources_v2/out.cpp", caches, RunOptions{}, log, stop,
+                       [&](const WatchReport&) { ++ready; });
+    });
+    // ждём нужного вывода не дольше 10 с: событие приходит не мгновенно
+    const auto wait_for = [](const std::string& expected) {
+        for (int i = 0; i < 1000; ++i) {
+            if (common::GetFileContents("sources_v2/out.cpp") == expected) return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return false;
+    };
+    for (int i = 0; i < 1000 && ready == 0; ++i) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    assert(ready > 0);
+    assert(wait_for("a2\nb2\nmain\n"));
+
+    std::ofstream("sources_v2/inc2/b.h") << "b2 edited\n";
+    assert(wait_for("a2\nb2 edited\nmain\n"));
+    std::ofstream("sources_v2/inc1/a.h") << "a1\n";  // inc1 раньше inc2 в порядке поиска
+    assert(wait_for("a1\nb2 edited\nmain\n"));
+
+    stop = true;
+    watcher.join();
+    assert(report.rebuilds >= 2 && report.failed == 0);
+    assert(report.resolver_resets >= 1);
+    assert(log.str().find(" ms после сохранения\n") != std::string::npos);
+}
+
+inline void RunV2Tests() {
+    TestFileCacheReadsOnce();
+    TestResolverOrderAndInvalidate();
+    TestBatchMatchesSingleRuns();
+    TestParallelMatchesSequential();
+    TestDepsGraph();
+    TestLargeVerbatimOutput();
+    TestNormalizeText();
+    TestIncludeCycleStops();
+    TestRunStatsCounters();
+    TestInMemoryMatchesDisk();
+    TestServeRevalidates();
+    TestConditionalSkipsInactive();
+    TestMinifyKeepsLiterals();
+    TestHoistSystemIncludes();
+    TestUnityShards();
+    TestWatchRebuilds();
+    common::TestDeepIncludeChain(&Preprocess);
+    common::TestDeepIncludeChain(&FlattenProject);
+    common::TestIncludeCycle(&Preprocess);
+    common::TestIncludeCycle(&FlattenProject);
+    common::TestFlattenIncludeOnce(&FlattenProject);
+    common::TestOutputWriteIfChanged(&FlattenProject);
+}
+
+} // namespace v2::tests
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "v2_preprocess_impl.h"
+
+namespace v2 {
+namespace fs = std::filesystem;
+
+// =======================
+// --unity: много TU -> N склеенных .cpp (unity build), чтобы компилировать параллельно
+// =======================
+//
+// Каждый shard — самостоятельный файл: свои TU подряд со своими <...> и
+// заголовками (include-once общий только внутри shard'а). TU сортируются
+// по пути и режутся на непрерывные отрезки, близкие по цене — размеру TU
+// после склейки. Непрерывность ради стабильности: правка одного TU двигает
+// самое большее соседние границы, остальные shard'ы не меняются ни на байт
+// и кэши компиляции (ccache, make) продолжают попадать.
+// Как у любого unity build: static-функции и макросы одного TU видны следующим.
+
+struct UnityShard {
+    fs::path out_file;
+    std::vector<fs::path> units;
+    std::uint64_t cost = 0;  // сумма цен TU (байт после склейки каждого по отдельности)
+};
+
+// Список TU: по пути на строку; пустые строки и строки с '#' в начале пропускаются
+inline std::vector<fs::path> ReadUnitList(std::istream& in) {
+    std::vector<fs::path> units;
+    std::string line;
+    while (std::getline(in, line)) {
+        RStripCR(line);
+        std::istringstream fields(line);
+        std::string unit;
+        if (!(fields >> unit) || unit[0] == '#') continue;
+        units.push_back(unit);
+    }
+    return units;
+}
+
+// Начала отрезков: не больше n непустых, граница k — там, где сумма цен ближе
+// всего к k/n общей. Зависит только от costs и n.
+inline std::vector<std::size_t> PlanShardBounds(const std::vector<std::uint64_t>& costs, std::size_t n) {
+    std::vector<std::size_t> starts;
+    if (costs.empty() || n == 0) return starts;
+    n = std::min(n, costs.size());
+
+    std::uint64_t total = 0;
+    for (std::uint64_t c : costs) total += c;
+
+    starts.push_back(0);
+    std::uint64_t prefix = 0;  // сумма costs[0, i)
+    std::size_t i = 0;
+    for (std::size_t k = 1; k < n; ++k) {
+        const std::uint64_t target = total / n * k + total % n * k / n;
+        // хотя бы один TU в текущем отрезке и по одному на каждый оставшийся
+        const std::size_t lo = starts.back() + 1;
+        const std::size_t hi = costs.size() - (n - k);
+        while (i < lo) prefix += costs[i++];
+        while (i < hi && prefix + costs[i] <= target) prefix += costs[i++];
+        // следующий TU перелетает цель: берём его, если так ближе
+        if (i < hi && prefix < target && target - prefix > prefix + costs[i] - target) prefix += costs[i++];
+        starts.push_back(i);
+    }
+    return starts;
+}
+
+namespace detail {
+
+// Номер shard'а по имени файла: unity_<k>.cpp или unity_<k>_sys.h; иначе false
+inline bool ShardIndexOf(const std::string& name, std::size_t& k) {
+    static const std::string kPrefix = "unity_";
+    if (name.compare(0, kPrefix.size(), kPrefix) != 0) return false;
+    std::size_t i = kPrefix.size();
+    const std::size_t digits = i;
+    k = 0;
+    for (; i < name.size() && name[i] >= '0' && name[i] <= '9'; ++i) k = k * 10 + static_cast<std::size_t>(name[i] - '0');
+    if (i == digits) return false;
+    const std::string rest = name.substr(i);
+    return rest == ".cpp" || rest == "_sys.h";
+}
+
+// Прошлый прогон дал больше shard'ов: их файлы удаляются, иначе сборка по
+// маске unity_*.cpp скомпилирует устаревшие копии TU второй раз
+inline void RemoveStaleShards(const fs::path& out_dir, std::size_t count) {
+    std::error_code ec;
+    std::vector<fs::path> stale;
+    for (fs::directory_iterator it(out_dir, ec), end; !ec && it != end; it.increment(ec)) {
+        std::size_t k = 0;
+        if (ShardIndexOf(it->path().filename().string(), k) && k >= count) stale.push_back(it->path());
+    }
+    for (const fs::path& file : stale) fs::remove(file, ec);
+}
+
+} // namespace detail
+
+// Склеивает units в не больше чем shards файлов out_dir/unity_<k>.cpp;
+// unity_<k>.cpp и unity_<k>_sys.h с большими номерами от прошлых прогонов удаляются.
+// false — какой-то TU не открылся или не склеился (сообщения — в log).
+inline bool FlattenShards(std::vector<fs::path> units,
+                          const fs::path& out_dir,
+                          std::size_t shards,
+                          SharedCaches& caches,
+                          const RunOptions& options,
+                          std::vector<UnityShard>& result,
+                          RunStats& stats,
+                          std::ostream& log) {
+    std::sort(units.begin(), units.end(),
+              [](const fs::path& a, const fs::path& b) { return a.generic_string() < b.generic_string(); });
+    units.erase(std::unique(units.begin(), units.end()), units.end());
+
+    // цена TU — сколько байт он даёт после склейки с теми же опциями
+    // (conditional, minify, hoist), только без записи заголовка; файлы при
+    // этом уже оказываются в кэше, и сама склейка их не перечитывает
+    RunOptions cost_options = options;
+    cost_options.system_header.clear();
+    std::vector<std::uint64_t> costs;
+    for (const fs::path& unit : units) {
+        if (!caches.provider.CanOpen(unit)) {
+            log << "cannot open " << unit.string() << "\n";
+            return false;
+        }
+        CallbackSink counter([](std::string_view) {});
+        RunStats scratch;
+        if (!detail::ExpandInto(unit, counter, Mode::Flatten, cost_options, caches, scratch, log)) return false;
+        stats.files += scratch.files;
+        stats.resolver += scratch.resolver;
+        costs.push_back(scratch.output.bytes);
+    }
+
+    std::error_code ec;
+    fs::create_directories(out_dir, ec);
+
+    const std::vector<std::size_t> starts = PlanShardBounds(costs, shards);
+    result.clear();
+    bool ok = true;
+    for (std::size_t k = 0; k < starts.size(); ++k) {
+        const std::size_t end = k + 1 < starts.size() ? starts[k + 1] : units.size();
+        UnityShard shard;
+        shard.out_file = out_dir / ("unity_" + std::to_string(k) + ".cpp");
+        shard.units.assign(units.begin() + starts[k], units.begin() + end);
+        for (std::size_t i = starts[k]; i < end; ++i) shard.cost += costs[i];
+
+        RunOptions shard_options = options;
+        if (!options.system_header.empty()) {
+            shard_options.system_header = out_dir / ("unity_" + std::to_string(k) + "_sys.h");
+        }
+        OutputWriter out;
+        ok = out.Open(shard.out_file) &&
+             detail::ExpandUnitsInto(shard.units, out, Mode::Flatten, shard_options, caches, stats, log) && ok;
+        result.push_back(std::move(shard));
+    }
+    detail::RemoveStaleShards(out_dir, starts.size());
+    return ok;
+}
+
+} // namespace v2
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include "../common/include_once.h"
+#include "v2_source.h"
+
+namespace v2 {
+namespace fs = std::filesystem;
+
+// =======================
+// Откуда движок берёт файлы: с диска или из памяти (встраивание, тесты,
+// сгенерированный код без временных файлов)
+// =======================
+//
+// Всё, что движку нужно от файловой системы, — здесь: открыть файл, проверить,
+// что это файл, перечислить файлы каталога include (для индекса) и получить
+// identity для include-once. Провайдер должен быть потокобезопасен на чтение.
+
+// Версия файла или каталога: долгоживущие кэши сверяют её перед повтором
+struct FileStamp {
+    bool exists = false;
+    std::uint64_t size = 0;
+    std::int64_t mtime = 0;  // диск: время изменения; память: номер версии
+
+    bool operator==(const FileStamp& other) const {
+        return exists == other.exists && size == other.size && mtime == other.mtime;
+    }
+    bool operator!=(const FileStamp& other) const { return !(*this == other); }
+};
+
+#ifdef V2_HAVE_MMAP
+// Версия файла по результату stat/fstat
+inline FileStamp StampFromStat(const struct stat& st) {
+    FileStamp stamp;
+    stamp.exists = true;
+    if (S_ISREG(st.st_mode)) stamp.size = static_cast<std::uint64_t>(st.st_size);
+#if defined(__APPLE__)
+    stamp.mtime = static_cast<std::int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    stamp.mtime = static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return stamp;
+}
+#endif
+
+class FileProvider {
+public:
+    virtual ~FileProvider() = default;
+
+    // Входной файл можно открыть (как std::ifstream(in_file).is_open())
+    virtual bool CanOpen(const fs::path& file) = 0;
+
+    // Содержимое в buffer. false — файла нет.
+    virtual bool Open(const fs::path& file, SourceBuffer& buffer) = 0;
+
+    // Кандидат include существует и это не каталог
+    virtual bool IsFile(const fs::path& file) = 0;
+
+    // Все файлы и подкаталоги под dir, пути относительно dir; подкаталог
+    // приходит раньше своего содержимого. false — каталога нет.
+    // complete = false — список может быть неполон (симлинки на каталоги, обход оборвался);
+    // тогда поиск, не найдя файл в индексе, проверит каталоги по одному.
+    virtual bool ListFiles(const fs::path& dir, const std::function<void(const fs::path& rel, bool is_dir)>& visit,
+                           bool& complete) = 0;
+
+    // Каталог меняет версию, когда в нём появляется или исчезает запись
+    virtual FileStamp Stamp(const fs::path& path) = 0;
+
+    // Один файл — одна строка, как бы к нему ни пришли
+    virtual std::string Identity(const fs::path& file) = 0;
+};
+
+class DiskFileProvider final : public FileProvider {
+public:
+    bool CanOpen(const fs::path& file) override {
+        std::ifstream probe(file);
+        return probe.is_open();
+    }
+
+    bool Open(const fs::path& file, SourceBuffer& buffer) override { return buffer.Open(file); }
+
+    bool IsFile(const fs::path& file) override {
+        std::error_code ec;
+        const fs::file_status st = fs::status(file, ec);
+        return !ec && fs::exists(st) && !fs::is_directory(st);
+    }
+
+    bool ListFiles(const fs::path& dir, const std::function<void(const fs::path& rel, bool is_dir)>& visit,
+                   bool& complete) override {
+        complete = true;
+        std::error_code ec;
+        fs::recursive_directory_iterator it(dir, fs::directory_options::skip_permission_denied, ec);
+        if (ec) return false;
+        for (; it != fs::recursive_directory_iterator(); it.increment(ec)) {
+            if (ec) {
+                complete = false;  // обход оборвался — дальше не видели
+                break;
+            }
+            std::error_code st_ec;
+            const bool is_dir = it->is_directory(st_ec);
+            // в симлинки на каталоги итератор не заходит — для них список неполон
+            if (is_dir && it->is_symlink(st_ec)) {
+                complete = false;
+                continue;
+            }
+            visit(it->path().lexically_relative(dir), is_dir);
+        }
+        return true;
+    }
+
+    FileStamp Stamp(const fs::path& path) override {
+        FileStamp stamp;
+#ifdef V2_HAVE_MMAP
+        struct stat st {};
+        if (::stat(path.c_str(), &st) != 0) return stamp;
+        stamp = StampFromStat(st);
+#else
+        std::error_code ec;
+        const fs::file_status st = fs::status(path, ec);
+        if (ec || !fs::exists(st)) return stamp;
+        stamp.exists = true;
+        if (fs::is_regular_file(st)) stamp.size = fs::file_size(path, ec);
+        const auto mtime = fs::last_write_time(path, ec);
+        if (!ec) stamp.mtime = std::chrono::duration_cast<std::chrono::nanoseconds>(mtime.time_since_epoch()).count();
+#endif
+        return stamp;
+    }
+
+    std::string Identity(const fs::path& file) override { return common::FileIdentity(file); }
+};
+
+// Провайдер по умолчанию для всех входов с fs::path
+inline FileProvider& DiskFiles() {
+    static DiskFileProvider disk;
+    return disk;
+}
+
+// Файлы в памяти: путь -> текст. Пути сравниваются после lexically_normal,
+// так что "dir/../a.h" и "a.h" — один файл. Текст не копируется при чтении:
+// не меняйте набор файлов, пока идёт прогон, а после изменения вызовите
+// Revalidate() у кэшей, которые переживают прогон (иначе они смотрят в старый текст).
+class MemoryFileProvider final : public FileProvider {
+public:
+    void Add(const fs::path& file, std::string text) {
+        File& entry = files_[Key(file)];
+        entry.text = std::move(text);
+        entry.version = ++generation_;
+    }
+    void Remove(const fs::path& file) {
+        if (files_.erase(Key(file)) != 0) ++generation_;
+    }
+
+    bool CanOpen(const fs::path& file) override { return files_.count(Key(file)) != 0; }
+
+    bool Open(const fs::path& file, SourceBuffer& buffer) override {
+        auto it = files_.find(Key(file));
+        if (it == files_.end()) return false;
+        buffer.Borrow(it->second.text);
+        return true;
+    }
+
+    bool IsFile(const fs::path& file) override { return CanOpen(file); }
+
+    // Каталогов отдельно нет: подкаталоги не перечисляются, а версия любого
+    // каталога — номер последнего изменения набора файлов
+    FileStamp Stamp(const fs::path& path) override {
+        FileStamp stamp;
+        stamp.exists = true;
+        auto it = files_.find(Key(path));
+        if (it == files_.end()) {
+            stamp.mtime = static_cast<std::int64_t>(generation_);
+        } else {
+            stamp.size = it->second.text.size();
+            stamp.mtime = static_cast<std::int64_t>(it->second.version);
+        }
+        return stamp;
+    }
+
+    bool ListFiles(const fs::path& dir, const std::function<void(const fs::path& rel, bool is_dir)>& visit,
+                   bool& complete) override {
+        complete = true;
+        std::string prefix = Key(dir);
+        if (prefix == ".") prefix.clear();
+        if (!prefix.empty() && prefix.back() != '/') prefix += '/';
+        bool any = false;
+        for (auto it = files_.lower_bound(prefix); it != files_.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it) {
+            visit(fs::path(it->first.substr(prefix.size())), false);
+            any = true;
+        }
+        return any;
+    }
+
+    std::string Identity(const fs::path& file) override { return Key(file); }
+
+private:
+    static std::string Key(const fs::path& file) { return file.lexically_normal().generic_string(); }
+
+    struct File {
+        std::string text;
+        std::uint64_t version = 0;
+    };
+
+    std::map<std::string, File> files_;  // упорядочен: ListFiles — диапазон по префиксу
+    std::uint64_t generation_ = 0;
+};
+
+} // namespace v2
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "v2_preprocess_impl.h"
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#define V2_HAVE_INOTIFY 1
+#endif
+
+namespace v2 {
+namespace fs = std::filesystem;
+
+// =======================
+// --watch: склеить один раз и пересклеивать при каждом сохранении
+// =======================
+//
+// Кэши живут весь сеанс, как у --serve, но сверяться с диском не нужно:
+// об изменениях сообщает ОС (inotify). Следим за каталогами, а не за файлами:
+// редакторы сохраняют через переименование, и файл, на который смотрели,
+// исчезает. Каталоги — все, где лежат файлы графа, плюс каталоги поиска include.
+//
+// На событие: из кэша выбрасываются только изменённые файлы (остальные
+// отдаются из памяти без чтения и разбора), а кэш поиска include сбрасывается,
+// только если в каталоге что-то появилось, исчезло или переименовано и версия
+// каталога, повлиявшего на ответы, изменилась (новый файл в более раннем
+// include_dir перекрывает найденный). Вывод пишется заново, неизменённые куски
+// файлов — прямо из кэша (writev / copy_file_range).
+// Без inotify (не Linux или inotify_init не удался) — опрос: раз в kPollMs
+// сверка кэшей с диском по размеру и mtime.
+
+struct WatchReport {
+    std::size_t rebuilds = 0;          // пересклеек после изменений (первая склейка не в счёт)
+    std::size_t failed = 0;            // из них неудачных
+    std::size_t files_dropped = 0;     // файлов перечитано после изменений
+    std::size_t resolver_resets = 0;   // сколько раз кэш поиска include сбрасывался
+    std::size_t directories = 0;       // каталогов под наблюдением
+    double last_latency_ms = 0;        // от сохранения до готового вывода, последняя пересклейка
+    double max_latency_ms = 0;
+};
+
+namespace detail {
+
+// Одно изменение в каталоге: path — путь так, как его видит кэш (каталог + имя)
+struct WatchChange {
+    fs::path path;
+    bool entry = false;  // файл появился, исчез или переименован (а не просто записан)
+};
+
+struct WatchEvents {
+    std::vector<WatchChange> changes;
+    bool rescan = false;  // подробностей нет (опрос, переполнение очереди) — сверить всё
+    std::chrono::steady_clock::time_point since;  // когда пришло первое событие
+};
+
+class DirWatcher {
+public:
+    static constexpr int kPollMs = 100;   // как часто проверять stop (и опрашивать диск без inotify)
+    static constexpr int kSettleMs = 5;   // редактор сохраняет несколькими событиями подряд — дождаться всех
+
+#if defined(V2_HAVE_INOTIFY)
+    DirWatcher() : fd_(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) {}
+    ~DirWatcher() {
+        if (fd_ >= 0) ::close(fd_);
+    }
+#else
+    DirWatcher() = default;
+#endif
+    DirWatcher(const DirWatcher&) = delete;
+    DirWatcher& operator=(const DirWatcher&) = delete;
+
+    // dir — как в путях кэша (пустой — текущий каталог). true — каталог новый.
+    bool Add(const fs::path& dir) {
+        std::string buf;
+        const std::string& key = PathString(dir, buf);
+        if (!added_.insert(key).second) return false;
+#if defined(V2_HAVE_INOTIFY)
+        if (fd_ >= 0) {
+            const int wd = inotify_add_watch(fd_, dir.empty() ? "." : dir.c_str(), kMask);
+            if (wd < 0) {
+                added_.erase(key);  // каталога пока нет — попробуем после следующей склейки
+                return false;
+            }
+            // один каталог под разными именами ("a", "b/../a") — один wd
+            dirs_[wd].push_back(dir);
+        }
+#endif
+        return true;
+    }
+
+    std::size_t Size() const { return added_.size(); }
+
+    // Ждёт событий не дольше timeout_ms; false — ничего не случилось
+    bool Wait(int timeout_ms, WatchEvents& events) {
+#if defined(V2_HAVE_INOTIFY)
+        if (fd_ >= 0) {
+            pollfd pfd{fd_, POLLIN, 0};
+            if (::poll(&pfd, 1, timeout_ms) <= 0) return false;
+            events.since = std::chrono::steady_clock::now();
+            do {
+                Drain(events);
+            } while (::poll(&pfd, 1, kSettleMs) > 0);
+            return !events.changes.empty() || events.rescan;
+        }
+#endif
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+        events.since = std::chrono::steady_clock::now();
+        events.rescan = true;
+        return true;
+    }
+
+private:
+#if defined(V2_HAVE_INOTIFY)
+    static constexpr std::uint32_t kMask = IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                           IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+    void Drain(WatchEvents& events) {
+        alignas(inotify_event) char buf[16 * 1024];
+        for (;;) {
+            const ssize_t n = ::read(fd_, buf, sizeof(buf));
+            if (n <= 0) return;
+            for (ssize_t pos = 0; pos < n;) {
+                const auto* ev = reinterpret_cast<const inotify_event*>(buf + pos);
+                pos += static_cast<ssize_t>(sizeof(inotify_event) + ev->len);
+                Take(*ev, events);
+            }
+        }
+    }
+
+    void Take(const inotify_event& ev, WatchEvents& events) {
+        if (ev.mask & IN_Q_OVERFLOW) {
+            events.rescan = true;
+            return;
+        }
+        auto it = dirs_.find(ev.wd);
+        if (it == dirs_.end()) return;
+        if (ev.mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+            // сам каталог удалён или переехал: за ним больше не следим, что пропало — не знаем
+            if (ev.mask & IN_IGNORED) {
+                for (const fs::path& dir : it->second) added_.erase(dir.native());  // inotify — только Linux
+                dirs_.erase(it);
+            }
+            events.rescan = true;
+            return;
+        }
+        if (ev.len == 0) return;
+        const bool entry = (ev.mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)) != 0;
+        for (const fs::path& dir : it->second) {
+            events.changes.push_back({dir.empty() ? fs::path(ev.name) : dir / ev.name, entry});
+        }
+    }
+
+    int fd_ = -1;
+    std::unordered_map<int, std::vector<fs::path>> dirs_;  // wd -> каталог под всеми именами
+#endif
+    std::unordered_set<std::string> added_;
+};
+
+} // namespace detail
+
+// Склеивает in_file в out_file и пересклеивает после каждого изменения, пока
+// не выставлен stop (проверяется раз в DirWatcher::kPollMs). Сообщения — в log,
+// по строке на склейку. on_ready (если задан) зовётся, когда вывод готов и
+// за новыми каталогами уже следят.
+inline WatchReport Watch(const fs::path& in_file,
+                         const fs::path& out_file,
+                         SharedCaches& caches,
+                         const RunOptions& options,
+                         std::ostream& log,
+                         const std::atomic<bool>& stop,
+                         const std::function<void(const WatchReport&)>& on_ready = {}) {
+    using Clock = std::chrono::steady_clock;
+    WatchReport report;
+    detail::DirWatcher watcher;
+
+    // свой же вывод в наблюдаемом каталоге (и его временные файлы) — не изменение
+    const auto own = [](const fs::path& path, const fs::path& file) {
+        if (file.empty()) return false;
+        const std::string name = Normalize(file).generic_string();
+        const std::string seen = Normalize(path).generic_string();
+        return seen.compare(0, name.size(), name) == 0 &&
+               (seen.size() == name.size() || seen.compare(name.size(), 4, ".tmp") == 0);
+    };
+    const auto is_own = [&](const fs::path& path) {
+        return own(path, out_file) || own(path, options.system_header);
+    };
+
+    // Склейка и наблюдение за всем, что в ней участвовало. true — за новыми
+    // каталогами начали следить уже после того, как их прочитали.
+    bool ok = false;
+    const auto build = [&] {
+        RunStats stats;
+        ok = detail::ExpandProject(in_file, out_file, Mode::Flatten, options, caches, stats, log);
+        if (!ok) log << "watch: склейка " << in_file.string() << " не удалась, жду правок\n";
+        bool added = watcher.Add(in_file.parent_path());
+        for (const fs::path& dir : caches.resolver.IncludeDirectories()) added = watcher.Add(dir) || added;
+        for (const fs::path& dir : caches.resolver.WatchedDirectories()) added = watcher.Add(dir) || added;
+        for (const fs::path& file : caches.files.Paths()) added = watcher.Add(file.parent_path()) || added;
+        report.directories = watcher.Size();
+        return added;
+    };
+    // Правка между чтением файла и началом слежки за его каталогом событием
+    // не придёт — такие находит сверка с диском (только после новых каталогов)
+    const auto build_settled = [&](std::size_t& dropped, bool& reset) {
+        while (build()) {
+            const std::size_t late = caches.files.Revalidate();
+            const bool late_reset = caches.resolver.Revalidate();
+            if (late == 0 && !late_reset) break;
+            dropped += late;
+            reset = reset || late_reset;
+        }
+    };
+
+    {
+        std::size_t dropped = 0;
+        bool reset = false;
+        build_settled(dropped, reset);
+    }
+    log << "watch: " << out_file.string() << " склеен, каталогов под наблюдением " << report.directories << "\n";
+    log.flush();
+    if (on_ready) on_ready(report);
+
+    while (!stop.load()) {
+        detail::WatchEvents events;
+        if (!watcher.Wait(detail::DirWatcher::kPollMs, events)) continue;
+
+        std::size_t dropped = 0;
+        bool entries = false;
+        for (const detail::WatchChange& change : events.changes) {
+            if (is_own(change.path)) continue;
+            if (caches.files.Forget(change.path)) ++dropped;
+            entries = entries || change.entry;
+        }
+        if (events.rescan) dropped += caches.files.Revalidate();
+        bool reset = (entries || events.rescan) && caches.resolver.Revalidate();
+        // временные файлы редактора и прочее, что в склейку не попадает
+        if (dropped == 0 && !reset) continue;
+
+        build_settled(dropped, reset);
+        const double ms = std::chrono::duration<double, std::milli>(Clock::now() - events.since).count();
+        ++report.rebuilds;
+        if (!ok) ++report.failed;
+        report.files_dropped += dropped;
+        if (reset) ++report.resolver_resets;
+        report.last_latency_ms = ms;
+        report.max_latency_ms = std::max(report.max_latency_ms, ms);
+
+        log << "watch: перечитано файлов " << dropped << (reset ? ", поиск include сброшен" : "") << ", "
+            << out_file.string() << (ok ? " готов" : " не склеен") << " через " << ms << " ms после сохранения\n";
+        log.flush();
+        if (on_ready) on_ready(report);
+    }
+    return report;
+}
+
+} // namespace v2